@@ -0,0 +1,4014 @@
+/*
+ * Reinette II plus, a french Apple II emulator
+ * the machine itself : memory, soft switches, cassette, disks, save states ...
+ * powered by puce6502 - a MOS 6502 cpu emulator by the same author
+ * Copyright (c) 2020 Arthur Ferreira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifdef __unix__
+#define _XOPEN_SOURCE 700                                                       // posix_openpt, for the serial bridge
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "apple2.h"
+
+#if defined(THREADED) || defined(__unix__)
+#include <pthread.h>
+#endif
+#ifdef __unix__
+#include <stdatomic.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+
+// memory
+THREADLOCAL uint8_t ram[RAMSIZE];                                               // 48K of ram in $000-$BFFF
+uint8_t rom[ROMSIZE];                                                           // 12K of rom in $D000-$FFFF
+THREADLOCAL uint8_t lgc[LGCSIZE];                                               // Language Card 12K in $D000-$FFFF
+THREADLOCAL uint8_t bk2[BK2SIZE];                                               // bank 2 of Language Card 4K in $D000-$DFFF
+uint8_t sl6[SL6SIZE];                                                           // P5A disk ][ prom in slot 6 (and 5)
+THREADLOCAL uint8_t aux[AUXSIZE];                                               // 64K of auxiliary memory of the //e
+uint8_t romIIe[IIEROMSIZE];                                                     // 16K of //e rom in $C000-$FFFF
+
+
+//================================================================ SOFT SWITCHES
+
+THREADLOCAL uint8_t KBD   = 0;                                                  // $C000, $C010 ascii value of keyboard input
+THREADLOCAL bool TEXT  = true;                                                  // $C050 CLRTEXT  / $C051 SETTEXT
+THREADLOCAL bool MIXED = false;                                                 // $C052 CLRMIXED / $C053 SETMIXED
+THREADLOCAL bool PAGE2 = false;                                                 // $C054 PAGE2 off / $C055 PAGE2 on
+THREADLOCAL bool HIRES = false;                                                 // $C056 GR       / $C057 HGR
+THREADLOCAL bool LCWR  = true;                                                  // Language Card writable
+THREADLOCAL bool LCRD  = false;                                                 // Language Card readable
+THREADLOCAL bool LCBK2 = true;                                                  // Language Card bank 2 enabled
+THREADLOCAL bool LCWFF = false;                                                 // Language Card pre-write flip flop
+THREADLOCAL bool AN0   = false;                                                 // $C058 / $C059 annunciator 0, the Videx video switch
+
+THREADLOCAL bool apple2e   = false;                                             // an Apple //e instead of a II plus
+THREADLOCAL bool STORE80   = false;                                             // $C000 / $C001 PAGE2 switches the display memory
+THREADLOCAL bool RAMRD     = false;                                             // $C002 / $C003 read $0200-$BFFF from aux
+THREADLOCAL bool RAMWRT    = false;                                             // $C004 / $C005 write $0200-$BFFF to aux
+THREADLOCAL bool INTCXROM  = false;                                             // $C006 / $C007 internal rom in $C100-$CFFF
+THREADLOCAL bool ALTZP     = false;                                             // $C008 / $C009 aux zero page, stack and LC
+THREADLOCAL bool SLOTC3ROM = false;                                             // $C00A / $C00B slot 3 rom instead of the 80 columns one
+THREADLOCAL bool COL80     = false;                                             // $C00C / $C00D 80 columns display
+THREADLOCAL bool ALTCHAR   = false;                                             // $C00E / $C00F alternate character set
+THREADLOCAL bool DHIRES    = false;                                             // $C05F / $C05E double high res
+THREADLOCAL bool INTC8ROM  = false;                                             // internal rom in $C800-$CFFF, until $CFFF
+
+
+static inline uint8_t floatingBus() {                                           // what an unanswered read gives
+	return ticks & 0xFF;
+}
+
+
+//===================================================================== KEYBOARD
+// the text typed by the host is queued, and each key is given once the
+// program has read the previous one and cleared the strobe at $C010 : nothing
+// is lost and, the front end running unthrottled meanwhile, no time is wasted
+
+THREADLOCAL struct typeAhead typeAhead = { 0 };
+
+
+static int reserveKeys(long length) {                                           // room for length more keys
+	if (typeAhead.pos == typeAhead.count)
+		typeAhead.pos = typeAhead.count = 0;
+	if (typeAhead.count + length > typeAhead.capacity) {
+		long capacity = typeAhead.count + length + 4096;
+		uint8_t *keys = realloc(typeAhead.keys, capacity);
+		if (!keys) return 0;
+		typeAhead.keys = keys;
+		typeAhead.capacity = capacity;
+	}
+	return 1;
+}
+
+
+int typeText(const char *text, long length) {                                   // 0 if out of memory
+	if (!reserveKeys(length)) return 0;
+	for (long i = 0; i < length; i++) {
+		if (text[i] == '\r' && i + 1 < length && text[i + 1] == '\n') continue;     // CR LF is a single return
+		typeAhead.keys[typeAhead.count++] = (text[i] == '\n' ? '\r' : text[i]) | 0x80;
+	}
+	for (long i = 0; i < length; i += 0xFFFF)                                     // events are 64K at most
+		movieEvent('Y', text + i, length - i < 0xFFFF ? length - i : 0xFFFF);
+
+	if (!(KBD & 0x80) && !typeAhead.unread && typeAhead.pos < typeAhead.count) { // nothing waiting : the first key now
+		KBD = typeAhead.keys[typeAhead.pos++];
+		typeAhead.unread = true;
+	}
+	return 1;
+}
+
+
+bool keysPending() {                                                            // the program has yet to read them
+	return typeAhead.unread || typeAhead.pos < typeAhead.count;
+}
+
+
+static uint8_t clearStrobe() {                                                  // $C010 KBDSTROBE
+	if (typeAhead.unread) return KBD & 0x7F;                                      // a typed key is kept until read
+	KBD &= 0x7F;
+	uint8_t value = KBD;
+	if (typeAhead.pos < typeAhead.count) {                                        // and the next one is given at once
+		KBD = typeAhead.keys[typeAhead.pos++];
+		typeAhead.unread = true;
+	}
+	return value;
+}
+
+
+//====================================================================== PADDLES
+
+THREADLOCAL uint8_t PB0 = 0;                                                    // $C061 Push Button 0 (bit 7) / Open Apple
+THREADLOCAL uint8_t PB1 = 0;                                                    // $C062 Push Button 1 (bit 7) / Solid Apple
+THREADLOCAL uint8_t PB2 = 0;                                                    // $C063 Push Button 2 (bit 7) / shift mod !!!
+THREADLOCAL float GCP[2] = { 127.0f, 127.0f };                                  // GC Position ranging from 0 (left) to 255 right
+THREADLOCAL float GCC[2] = { 0.0f };                                            // $C064 (GC0) and $C065 (GC1) Countdowns
+THREADLOCAL int GCD[2] = { 0 };                                                 // GC0 and GC1 Directions (left/down or right/up)
+THREADLOCAL int GCA[2] = { 0 };                                                 // GC0 and GC1 Action (push or release)
+THREADLOCAL long long int GCCrigger;                                            // $C070 the tick at which the GCs were reseted
+
+inline static void resetPaddles() {
+	GCC[0] = GCP[0] * GCP[0];                                                     // initialize the countdown for both paddles
+	GCC[1] = GCP[1] * GCP[1];                                                     // to the square of their actuall values (positions)
+	GCCrigger = ticks;                                                            // records the time this was done
+}
+
+inline static uint8_t readPaddle(int pdl) {
+	const float GCFreq = 6.6;                                                     // the speed at which the GC values decrease
+
+	GCC[pdl] -= (ticks - GCCrigger) / GCFreq;                                     // decreases the countdown
+	if (GCC[pdl] <= 0)                                                            // timeout
+		return GCC[pdl] = 0;                                                        // returns 0
+	return 0x80;                                                                  // not timeout, return something with the MSB set
+}
+
+
+//====================================================================== SPEAKER
+
+THREADLOCAL bool warp = false;                                                  // unthrottled execution, sound is not queued
+THREADLOCAL bool ahead = false;                                                 // frames run ahead, to be thrown away
+THREADLOCAL bool SPKR = false;                                                  // $C030 Speaker toggle
+THREADLOCAL long long int speakerTick = 0LL;                                    // tick of the last toggle
+
+static void playSound() {
+	SPKR = !SPKR;                                                                 // toggle speaker state
+	unsigned int length = (ticks - speakerTick) / 10.65625;                       // 1023000Hz / 96000Hz = 10.65625
+	speakerTick = ticks;
+	if (!warp && !ahead) queueSound(SPKR, length);                                // played by the front end
+}
+
+
+//===================================================================== CASSETTE
+
+bool hasExtension(const char *filename, const char *ext) {
+	size_t len = strlen(filename), extLen = strlen(ext);
+	return len > extLen && !strcasecmp(filename + len - extLen, ext);
+}
+
+THREADLOCAL struct cassette tape = { .fastLoad = true };
+
+
+static int decodeTape() {                                                       // edges -> Monitor format blocks, 0 if no memory
+	int size = 0, bits = 0, blockLen = 0, i = 1;
+	uint8_t byte = 0;
+
+	while (i < tape.edgeCount) {
+		int header = 0;                                                             // look for the 770Hz header tone
+		while (i < tape.edgeCount && (header < 64 || tape.edges[i] - tape.edges[i - 1] > 450)) {
+			unsigned long long int half = tape.edges[i] - tape.edges[i - 1];
+			header = (half > 550 && half < 800) ? header + 1 : 0;                     // 650us half cycles
+			i++;
+		}
+		i += 2;                                                                     // skip the sync bit
+
+		blockLen = bits = 0;
+		while (i < tape.edgeCount) {                                                // data bits : two half cycles each
+			unsigned long long int half = tape.edges[i] - tape.edges[i - 1];
+			unsigned long long int full = i + 1 < tape.edgeCount ? tape.edges[i + 1] - tape.edges[i - 1] : ~0ULL;
+			bool last = full > 1500;                                                  // end of block (silence or header)
+			if (last) {
+				if (half > 600) break;
+				full = half * 2;                                                        // but the last half cycle is open ended
+			}
+			byte = (byte << 1) | (full > 768);                                        // 2000Hz is a 0, 1000Hz is a 1
+			if (++bits == 8) {
+				if (size % 4096 == 0) {
+					uint8_t *bytes = realloc(tape.bytes, size + 4096);
+					if (!bytes) return 0;                                                 // the old one is freed by the caller
+					tape.bytes = bytes;
+				}
+				tape.bytes[size++] = byte;
+				blockLen++;
+				bits = 0;
+			}
+			i += 2;
+			if (last) break;
+		}
+		if (blockLen > 1) {                                                         // at least one byte and the checksum
+			if (tape.blockCount % 64 == 0) {
+				int *blocks = realloc(tape.blocks, (tape.blockCount + 64) * sizeof(int));
+				if (!blocks) return 0;
+				tape.blocks = blocks;
+			}
+			tape.blocks[tape.blockCount++] = blockLen;
+		} else {
+			size -= blockLen;                                                         // noise, forget it
+		}
+	}
+	return 1;
+}
+
+
+void rewindTape() {
+	tape.playing = false;
+	tape.edgeIdx = tape.blockIdx = tape.byteIdx = 0;
+}
+
+
+static void ejectTape() {
+	free(tape.edges);
+	free(tape.bytes);
+	free(tape.blocks);
+	tape.edges = NULL;
+	tape.bytes = NULL;
+	tape.blocks = NULL;
+	tape.edgeCount = tape.blockCount = 0;
+	tape.filename[0] = 0;
+	rewindTape();
+}
+
+
+int insertTape(char *filename) {
+	FILE *f = fopen(filename, "rb");
+	if (!f) return 0;
+
+	uint8_t hdr[12], chunk[8], fmt[16] = { 0 };
+	if (fread(hdr, 1, 12, f) != 12 || memcmp(hdr, "RIFF", 4) || memcmp(hdr + 8, "WAVE", 4)) {
+		fclose(f);
+		return 0;                                                                   // not a wav file
+	}
+
+	long dataSize = 0;
+	while (fread(chunk, 1, 8, f) == 8) {                                          // walk the chunks until "data"
+		long len = chunk[4] | chunk[5] << 8 | chunk[6] << 16 | (long)chunk[7] << 24;
+		if (!memcmp(chunk, "fmt ", 4)) {
+			if (len < 16 || fread(fmt, 1, 16, f) != 16) break;
+			fseek(f, (len - 16 + 1) & ~1L, SEEK_CUR);
+		} else if (!memcmp(chunk, "data", 4)) {
+			dataSize = len;
+			break;
+		} else {
+			fseek(f, (len + 1) & ~1L, SEEK_CUR);                                      // chunks are word aligned
+		}
+	}
+
+	int channels = fmt[2] | fmt[3] << 8;
+	long rate = fmt[4] | fmt[5] << 8 | fmt[6] << 16 | (long)fmt[7] << 24;
+	int depth = (fmt[14] | fmt[15] << 8) / 8;                                     // bytes per sample
+	if (!dataSize || fmt[0] != 1 || !channels || channels * depth > 8 || !rate || depth < 1 || depth > 2) {
+		fclose(f);
+		return 0;                                                                   // only PCM 8 or 16 bits
+	}
+
+	ejectTape();                                                                  // the previous one
+
+	uint8_t sample[8];
+	bool level = false;
+	for (long n = 0; n < dataSize / (channels * depth); n++) {                    // find the zero crossings
+		if (fread(sample, depth, channels, f) != (size_t)channels) break;
+		int s = depth == 1 ? sample[0] - 128 : (signed char)sample[1];              // first channel, 8 bits precision
+		if ((level && s < -4) || (!level && s > 4)) {                               // with some hysteresis
+			level = !level;
+			if (tape.edgeCount % 4096 == 0) {
+				unsigned long long int *edges = realloc(tape.edges, (tape.edgeCount + 4096) * sizeof(*tape.edges));
+				if (!edges) {                                                           // too long a tape
+					fclose(f);
+					ejectTape();
+					return 0;
+				}
+				tape.edges = edges;
+			}
+			tape.edges[tape.edgeCount++] = (unsigned long long int)n * CPUFREQ / rate;
+		}
+	}
+	fclose(f);
+
+	if (!decodeTape()) {
+		ejectTape();
+		return 0;
+	}
+	sprintf(tape.filename, "%s", filename);
+	return 1;
+}
+
+
+static uint8_t readTape() {                                                     // $C060 TAPEIN
+	if (!tape.edgeCount) return ticks & 0x7F;
+	if (!tape.playing) {                                                          // press play
+		tape.playing = true;
+		tape.start = ticks;
+	}
+	while (tape.edgeIdx < tape.edgeCount && tape.edges[tape.edgeIdx] <= ticks - tape.start)
+		tape.edgeIdx++;
+	return (tape.edgeIdx & 1 ? 0x80 : 0x00) | (ticks & 0x7F);                     // bit 7 is the level
+}
+
+
+static uint8_t fastReadTape() {                                                 // replaces the Monitor READ routine
+	uint16_t a1 = ram[0x3C] | ram[0x3D] << 8;                                     // A1 : start address
+	uint16_t a2 = ram[0x3E] | ram[0x3F] << 8;                                     // A2 : end address
+	int len = tape.blocks[tape.blockIdx] - 1;                                     // checksum excluded
+	uint8_t *block = tape.bytes + tape.byteIdx;
+	uint8_t chksum = 0xFF;
+
+	for (int i = 0; ; i++) {                                                      // at least one byte, like the Monitor
+		uint8_t value = i < len ? block[i] : 0;
+		if (a1 < RAMSIZE) ram[a1] = value;
+		chksum ^= value;
+		if (a1++ == a2) break;
+	}
+	ram[0x3C] = a1 & 0xFF;                                                        // A1 ends up at A2 + 1
+	ram[0x3D] = a1 >> 8;
+	ram[0x2E] = chksum;                                                           // CHKSUM
+
+	tape.byteIdx += tape.blocks[tape.blockIdx++];                                 // next block
+	return 0x60;                                                                  // the cpu executes a RTS instead
+}
+
+
+static void writeTape() {                                                       // $C020 TAPEOUT
+	if (tape.out) {
+		unsigned long long int samples = (ticks - tape.outTick) * WAVRATE / CPUFREQ;
+		if (samples > WAVRATE) samples = WAVRATE;                                   // long silences are shortened to 1s
+		while (samples--) fputc(tape.outLevel ? 0xC0 : 0x40, tape.out);
+	}
+	tape.outLevel = !tape.outLevel;
+	tape.outTick = ticks;
+}
+
+
+int recordTape(char *filename) {                                                // start or stop the wav capture
+	static const uint8_t wavHeader[44] = {
+		'R','I','F','F', 0,0,0,0, 'W','A','V','E', 'f','m','t',' ', 16,0,0,0,       // sizes are patched at the end
+		1,0, 1,0, WAVRATE & 0xFF, WAVRATE >> 8,0,0, WAVRATE & 0xFF, WAVRATE >> 8,0,0,
+		1,0, 8,0, 'd','a','t','a', 0,0,0,0                                          // PCM, mono, 8 bits
+	};
+
+	if (tape.out) {                                                               // stop recording
+		writeTape();                                                                // close the last half cycle
+		for (int i = 0; i < WAVRATE / 10; i++) fputc(tape.outLevel ? 0xC0 : 0x40, tape.out);
+		long size = ftell(tape.out) - 44;
+		uint8_t len[4] = { (size + 36) & 0xFF, (size + 36) >> 8, (size + 36) >> 16, (size + 36) >> 24 };
+		fseek(tape.out, 4, SEEK_SET);
+		fwrite(len, 1, 4, tape.out);
+		for (int i = 0; i < 4; i++) len[i] = size >> (i * 8);
+		fseek(tape.out, 40, SEEK_SET);
+		fwrite(len, 1, 4, tape.out);
+		fclose(tape.out);
+		tape.out = NULL;
+		return 1;
+	}
+
+	tape.out = fopen(filename, "wb");
+	if (!tape.out || fwrite(wavHeader, 1, 44, tape.out) != 44) return 0;
+	tape.outTick = ticks;
+	return 1;
+}
+
+
+//====================================================================== DISK ][
+
+THREADLOCAL struct drive disk[DRIVES] = { 0 };                                  // two disk ][ drive units per controller
+THREADLOCAL struct controller diskII[CONTROLLERS] = { { true, 0 }, { false, 2 } };  // slot 6, slot 5 once a floppy is inserted
+
+
+static const uint8_t writeTable[64] = {                                         // 6 and 2 encoding, 6 bits -> disk nibble
+	0x96, 0x97, 0x9A, 0x9B, 0x9D, 0x9E, 0x9F, 0xA6, 0xA7, 0xAB, 0xAC, 0xAD, 0xAE, 0xAF, 0xB2, 0xB3,
+	0xB4, 0xB5, 0xB6, 0xB7, 0xB9, 0xBA, 0xBB, 0xBC, 0xBD, 0xBE, 0xBF, 0xCB, 0xCD, 0xCE, 0xCF, 0xD3,
+	0xD6, 0xD7, 0xD9, 0xDA, 0xDB, 0xDC, 0xDD, 0xDE, 0xDF, 0xE5, 0xE6, 0xE7, 0xE9, 0xEA, 0xEB, 0xEC,
+	0xED, 0xEE, 0xEF, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6, 0xF7, 0xF9, 0xFA, 0xFB, 0xFC, 0xFD, 0xFE, 0xFF
+};
+
+static const int skew[3][16] = {                                                // physical sector -> sector in the image file
+	{ 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15 },                     // NIB (unused)
+	{ 0, 7, 14, 6, 13, 5, 12, 4, 11, 3, 10, 2, 9, 1, 8, 15 },                     // DOS 3.3 order
+	{ 0, 8, 1, 9, 2, 10, 3, 11, 4, 12, 5, 13, 6, 14, 7, 15 }                      // ProDOS order
+};
+
+#define REV2(b) ((((b) & 1) << 1) | (((b) & 2) >> 1))                           // the two low bits, swapped
+
+
+static void spinFloppy(int drv) {                                               // turn the floppy up to the current tick
+	struct drive *d = &disk[drv];
+	if (!d->motorOn) {                                                            // the floppy doesn't move
+		d->nibbleTick = ticks;
+		return;
+	}
+
+	unsigned long long int now = d->motorStop && d->motorStop < ticks ? d->motorStop : ticks;
+	unsigned long long int slots = (now - d->nibbleTick) / NIBTICKS;
+	d->nibbleTick += slots * NIBTICKS;
+	if (d->writeMode && d->tracks[d->track] && slots > 1) {                       // nibbles skipped while writing
+		for (unsigned long long int n = 1; n < slots && n <= TRKSIZE; n++)          // (the 10 bits sync bytes) become sync bytes
+			d->tracks[d->track][(d->nibble + n) % TRKSIZE] = 0xFF;
+		d->dirty[d->track] = d->written[d->track] = true;
+	}
+	d->nibble = (d->nibble + slots) % TRKSIZE;
+
+	if (now != ticks) {                                                           // the motor stopped meanwhile
+		d->motorOn = false;
+		d->motorStop = 0;
+		d->nibbleTick = ticks;
+	}
+}
+
+
+static int nibblizeTrack(int drv, int track) {                                  // sectors -> 0x1A00 nibbles, 0 if no memory
+	uint8_t *nib = disk[drv].tracks[track] = malloc(TRKSIZE);
+	if (!nib) return 0;                                                           // the sectors stay in the image
+	int n = 0;
+
+	memset(nib, 0xFF, TRKSIZE);                                                   // sync bytes everywhere
+	n += 48;                                                                      // gap 1
+
+	for (int sector = 0; sector < 16; sector++) {                                 // physical order
+		uint8_t *data = disk[drv].image + track * 4096 + skew[disk[drv].format][sector] * 256;
+		uint8_t v[342];
+
+		const uint8_t addr[4] = { 254, track, sector, 254 ^ track ^ sector };       // volume, track, sector, checksum
+		nib[n++] = 0xD5; nib[n++] = 0xAA; nib[n++] = 0x96;                          // address field prologue
+		for (int i = 0; i < 4; i++) {                                               // 4 and 4 encoding
+			nib[n++] = (addr[i] >> 1) | 0xAA;
+			nib[n++] = addr[i] | 0xAA;
+		}
+		nib[n++] = 0xDE; nib[n++] = 0xAA; nib[n++] = 0xEB;                          // epilogue
+		n += 6;                                                                     // gap 2
+
+		for (int i = 0; i < 86; i++)                                                // two low bits of three bytes
+			v[i] = REV2(data[i]) | REV2(data[i + 86]) << 2 | (i < 84 ? REV2(data[i + 172]) << 4 : 0);
+		for (int i = 0; i < 256; i++)                                               // and the six high bits
+			v[86 + i] = data[i] >> 2;
+
+		nib[n++] = 0xD5; nib[n++] = 0xAA; nib[n++] = 0xAD;                          // data field prologue
+		for (int i = 0; i < 342; i++)
+			nib[n++] = writeTable[v[i] ^ (i ? v[i - 1] : 0)];                         // each value is xored with the previous one
+		nib[n++] = writeTable[v[341]];                                              // checksum
+		nib[n++] = 0xDE; nib[n++] = 0xAA; nib[n++] = 0xEB;                          // epilogue
+		n += 27;                                                                    // gap 3
+	}
+	return 1;
+}
+
+
+static int denibblizeTrack(int drv, int track) {                                // 0x1A00 nibbles -> sectors, 1 if all found
+	uint8_t readTable[256], *nib = disk[drv].tracks[track];
+	int found = 0;
+	if (!nib) return 1;                                                           // never nibblelized, nothing to decode
+
+	memset(readTable, 0xFF, 256);
+	for (int i = 0; i < 64; i++) readTable[writeTable[i]] = i;
+
+	for (int n = 0; n < TRKSIZE; n++) {                                           // look for address fields
+		if (nib[n] != 0xD5 || nib[(n + 1) % TRKSIZE] != 0xAA || nib[(n + 2) % TRKSIZE] != 0x96) continue;
+		int sector = ((nib[(n + 7) % TRKSIZE] << 1) | 1) & nib[(n + 8) % TRKSIZE];
+		if (sector > 15) continue;
+
+		int d = n + 14;                                                             // data field follows closely
+		while (d < n + 64 && (nib[d % TRKSIZE] != 0xD5 || nib[(d + 1) % TRKSIZE] != 0xAA || nib[(d + 2) % TRKSIZE] != 0xAD))
+			d++;
+		if (d == n + 64) continue;
+
+		uint8_t v[343], last = 0;
+		bool valid = true;
+		for (int i = 0; i < 343 && valid; i++) {
+			uint8_t value = readTable[nib[(d + 3 + i) % TRKSIZE]];
+			valid = value != 0xFF;
+			v[i] = last ^= value;                                                     // undo the xor chain
+		}
+		if (!valid || v[342]) continue;                                             // bad nibble or checksum
+
+		uint8_t *data = disk[drv].image + track * 4096 + skew[disk[drv].format][sector] * 256;
+		for (int i = 0; i < 256; i++)
+			data[i] = (v[86 + i] << 2) | REV2((v[i % 86] >> (2 * (i / 86))) & 3);
+		found |= 1 << sector;
+	}
+	return found == 0xFFFF;
+}
+
+
+//==================================================================== WOZ BITS
+
+static void wozRun(int drv, uint8_t value) {                                    // turn the floppy up to the current tick
+	struct drive *d = &disk[drv];
+	int trk = d->tmap[d->halfTrack * 2];                                          // quarter track under the head
+
+	unsigned long long int now = d->motorStop && d->motorStop < ticks ? d->motorStop : ticks;
+	unsigned long long int cycles = d->motorOn && now > d->bitTick ? now - d->bitTick : 0;
+	if (cycles > 0x100000) cycles = 0x100000;                                     // about one second is more than enough
+	int elapsed = d->bitFrac + (int)cycles * 8;
+	int bits = elapsed / d->bitTiming;                                            // 1 cycle is taken as 1us
+	d->bitFrac = elapsed % d->bitTiming;
+	d->bitTick = ticks;
+
+	if (trk == 0xFF || trk >= WOZTRKS) {                                          // unformatted quarter track
+		d->trk = 0xFF;
+		d->latch = 0;
+		return;
+	}
+	uint8_t *entry = d->trks + trk * 8;
+	unsigned int count = entry[4] | entry[5] << 8 | entry[6] << 16 | (unsigned int)entry[7] << 24;
+	uint8_t *data = d->image + (entry[0] | entry[1] << 8) * 512;
+	if (!count) return;
+
+	if (trk != d->trk) {                                                          // head moved, keep the angular position
+		unsigned int oldCount = 0;                                                  // none when coming from an unformatted one
+		if (d->trk < WOZTRKS) {
+			uint8_t *old = d->trks + d->trk * 8;
+			oldCount = old[4] | old[5] << 8 | old[6] << 16 | (unsigned int)old[7] << 24;
+		}
+		d->bitPos = oldCount ? (unsigned long long int)d->bitPos * count / oldCount : 0;
+		d->trk = trk;
+	}
+	if (d->bitPos >= count) d->bitPos = 0;
+
+	if (d->writeMode) {                                                           // shift out the data latch, MSB first
+		if (bits > count) bits = count;
+		while (bits--) {
+			uint8_t mask = 0x80 >> (d->bitPos & 7);
+			bool bit = d->writtenBits < 8 && (value << d->writtenBits++) & 0x80;      // then zeros (sync bytes are 10 bits)
+			data[d->bitPos >> 3] = (data[d->bitPos >> 3] & ~mask) | (bit ? mask : 0);
+			if (++d->bitPos == count) d->bitPos = 0;
+		}
+		d->dirty[trk] = d->written[trk] = true;
+		return;
+	}
+
+	if (bits > 64) {                                                              // only the last bits matter
+		d->bitPos = (d->bitPos + bits - 64) % count;
+		bits = 64;
+	}
+	while (bits--) {                                                              // shift in
+		bool bit = (data[d->bitPos >> 3] << (d->bitPos & 7) & 0x80) != 0;
+		if (++d->bitPos == count) d->bitPos = 0;
+
+		if ((d->latch & 0x80) && !d->held) {                                        // nibble complete, keep it visible
+			d->held = true;
+			d->heldBit = bit;
+			continue;
+		}
+		if (d->held) {                                                              // then start over
+			d->latch = d->heldBit;
+			d->held = false;
+		}
+		d->latch = (d->latch << 1) | bit;
+	}
+}
+
+
+static int loadWoz(int drv, uint8_t *image, long size) {
+	if (size < 256 || memcmp(image, "WOZ2\xFF\x0A\x0D\x0A", 8)) return 0;
+	if (memcmp(image + 12, "INFO", 4) || memcmp(image + 80, "TMAP", 4) || memcmp(image + 248, "TRKS", 4))
+		return 0;                                                                   // chunks are at fixed places in WOZ 2
+	if (image[21] != 1) return 0;                                                 // 5.25 inches only
+
+	for (int t = 0; t < WOZTRKS; t++) {                                           // check the bits are inside the file
+		uint8_t *entry = image + 256 + t * 8;
+		long end = ((entry[0] | entry[1] << 8) + (entry[2] | entry[3] << 8)) * 512L;
+		if (end > size) return 0;
+	}
+
+	disk[drv].format = WOZ;
+	disk[drv].tmap = image + 88;
+	disk[drv].trks = image + 256;
+	disk[drv].bitTiming = image[59] ? image[59] : 32;                             // optimal bit timing, 4us by default
+	disk[drv].trk = 0xFF;
+	disk[drv].bitTick = ticks;
+	return 1;
+}
+
+
+static unsigned int crc32(const uint8_t *buffer, long size) {                   // to update the WOZ header on save
+	static THREADLOCAL unsigned int table[256] = { 0 };
+	if (!table[1])                                                                // built on first use
+		for (unsigned int n = 0; n < 256; n++) {
+			unsigned int c = n;
+			for (int k = 0; k < 8; k++)
+				c = (c >> 1) ^ (0xEDB88320 & -(c & 1));
+			table[n] = c;
+		}
+
+	unsigned int crc = ~0U;
+	while (size--)
+		crc = (crc >> 8) ^ table[(crc ^ *buffer++) & 0xFF];
+	return ~crc;
+}
+
+
+//=============================================================== SHARED IMAGES
+// drives inserting the same file read the same image, the first one writing
+// to it gets its own copy. The shared one is kept as inserted, the states only
+// hold the tracks differing from it
+
+struct sharedImage {
+	char     filename[400];                                                       // emptied once the file was written
+	uint8_t  *image;                                                              // as loaded, delta included
+	long     size;
+	int      format;                                                              // NIB, DO, PO or WOZ
+	bool     compressed;
+	bool     changed[WOZTRKS];                                                    // tracks found in the .delta file
+	int      users;                                                               // drives reading it
+	struct sharedImage *next;
+} *sharedImages = NULL;                                                         // the images in use, all machines included
+
+#ifdef THREADED                                                                 // and all threads : the list is locked
+static pthread_mutex_t imagesLock = PTHREAD_MUTEX_INITIALIZER;
+#define LOCKIMAGES()   pthread_mutex_lock(&imagesLock)
+#define UNLOCKIMAGES() pthread_mutex_unlock(&imagesLock)
+#else
+#define LOCKIMAGES()
+#define UNLOCKIMAGES()
+#endif
+
+
+static struct sharedImage *findImage(const char *filename) {                   // called with the list locked
+	for (struct sharedImage *s = sharedImages; s; s = s->next)
+		if (!strcmp(s->filename, filename)) return s;
+	return NULL;
+}
+
+
+static struct sharedImage *shareImage(int drv) {                                // the image just loaded into drv
+	struct sharedImage *s = malloc(sizeof(struct sharedImage));
+	if (!s) return NULL;                                                          // the drive keeps it for itself
+	sprintf(s->filename, "%s", disk[drv].filename);
+	s->image = disk[drv].image;
+	s->size = disk[drv].size;
+	s->format = disk[drv].format;
+	s->compressed = disk[drv].compressed;
+	memcpy(s->changed, disk[drv].changed, sizeof(s->changed));
+	s->users = 1;
+	LOCKIMAGES();
+	s->next = sharedImages;
+	sharedImages = s;
+	UNLOCKIMAGES();
+	return s;
+}
+
+
+static void forgetImage(const char *filename) {                                 // the file changed, don't hand it out anymore
+	LOCKIMAGES();
+	for (struct sharedImage *s = sharedImages; s; s = s->next)
+		if (!strcmp(s->filename, filename)) s->filename[0] = 0;
+	UNLOCKIMAGES();
+}
+
+
+static void releaseImage(struct sharedImage *s) {                               // a drive stops reading it, list locked
+	if (--s->users) return;
+	struct sharedImage **p = &sharedImages;
+	while (*p != s) p = &(*p)->next;
+	*p = s->next;
+	free(s->image);
+	free(s);
+}
+
+
+static int ownImage(int drv) {                                                  // copy on write, 0 if it can't be written
+	struct drive *d = &disk[drv];
+	if (!d->shared || d->image != d->shared->image) return 1;                     // already its own
+	uint8_t *image = malloc(d->size);
+	if (!image) {                                                                 // never write to the shared one
+		d->readOnly = true;                                                         // (the other drives and states use it)
+		return 0;
+	}
+	memcpy(image, d->image, d->size);
+	d->image = image;
+	if (d->format == NIB)                                                         // the pointers into the image move too
+		for (int t = 0; t < TRACKS; t++) d->tracks[t] = image + t * TRKSIZE;
+	if (d->format == WOZ) {
+		d->tmap = image + 88;
+		d->trks = image + 256;
+	}
+	return 1;
+}
+
+
+//=========================================================== COMPRESSED IMAGES
+// gzip and zip files are inflated in memory when inserted, see RFC 1951
+
+struct inflater {
+	const uint8_t *in;                                                            // deflate stream
+	long     inSize, inPos;
+	unsigned int bitBuf;                                                          // bits not consumed yet
+	int      bitCount;
+	uint8_t  *out;                                                                // the image being inflated
+	long     outSize, outPos;
+};
+
+struct huffman {
+	short    count[16];                                                           // number of codes of each length
+	short    symbol[288];                                                         // symbols ordered by code
+};
+
+
+static int getBits(struct inflater *z, int n) {                                 // -1 past the end of the stream
+	while (z->bitCount < n) {
+		if (z->inPos == z->inSize) return -1;
+		z->bitBuf |= (unsigned int)z->in[z->inPos++] << z->bitCount;
+		z->bitCount += 8;
+	}
+	int bits = z->bitBuf & ((1 << n) - 1);
+	z->bitBuf >>= n;
+	z->bitCount -= n;
+	return bits;
+}
+
+
+static void buildHuffman(struct huffman *h, const uint8_t *lengths, int n) {    // canonical codes from their lengths
+	short offsets[16];
+	memset(h->count, 0, sizeof(h->count));
+	for (int i = 0; i < n; i++) h->count[lengths[i]]++;
+	h->count[0] = 0;
+	offsets[1] = 0;
+	for (int len = 1; len < 15; len++) offsets[len + 1] = offsets[len] + h->count[len];
+	for (int i = 0; i < n; i++)
+		if (lengths[i]) h->symbol[offsets[lengths[i]]++] = i;
+}
+
+
+static int decodeSymbol(struct inflater *z, const struct huffman *h) {          // one bit at a time, codes are MSB first
+	int code = 0, first = 0, index = 0;
+	for (int len = 1; len < 16; len++) {
+		int bit = getBits(z, 1);
+		if (bit < 0) return -1;
+		code |= bit;
+		if (code - first < h->count[len]) return h->symbol[index + code - first];
+		index += h->count[len];
+		first = (first + h->count[len]) << 1;
+		code <<= 1;
+	}
+	return -1;                                                                    // invalid code
+}
+
+
+static int inflateBlock(struct inflater *z, const struct huffman *lit, const struct huffman *dist) {
+	static const short lenBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	static const short lenExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	static const short distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	static const short distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	for (;;) {
+		int symbol = decodeSymbol(z, lit);
+		if (symbol < 0) return 0;
+		if (symbol == 256) return 1;                                                // end of block
+		if (symbol < 256) {                                                         // literal
+			if (z->outPos == z->outSize) return 0;
+			z->out[z->outPos++] = symbol;
+			continue;
+		}
+		symbol -= 257;                                                              // length and distance
+		if (symbol >= 29) return 0;
+		int extra = getBits(z, lenExtra[symbol]);
+		int length = lenBase[symbol] + extra;
+		int d = decodeSymbol(z, dist);
+		if (extra < 0 || d < 0 || d >= 30) return 0;
+		extra = getBits(z, distExtra[d]);
+		long distance = distBase[d] + extra;
+		if (extra < 0 || distance > z->outPos || length > z->outSize - z->outPos) return 0;
+		while (length--) {
+			z->out[z->outPos] = z->out[z->outPos - distance];
+			z->outPos++;
+		}
+	}
+}
+
+
+static int inflateStream(struct inflater *z) {                                  // 1 if the whole output was produced
+	struct huffman lit, dist;
+	int last;
+	do {
+		last = getBits(z, 1);
+		int type = getBits(z, 2);
+		if (type == 0) {                                                            // stored block, byte aligned
+			z->bitBuf = z->bitCount = 0;
+			if (z->inPos + 4 > z->inSize) return 0;
+			long len = z->in[z->inPos] | z->in[z->inPos + 1] << 8;
+			z->inPos += 4;
+			if (len > z->inSize - z->inPos || len > z->outSize - z->outPos) return 0;
+			memcpy(z->out + z->outPos, z->in + z->inPos, len);
+			z->inPos += len;
+			z->outPos += len;
+		} else if (type == 1) {                                                     // fixed codes
+			uint8_t lengths[288];
+			memset(lengths, 8, 144);
+			memset(lengths + 144, 9, 112);
+			memset(lengths + 256, 7, 24);
+			memset(lengths + 280, 8, 8);
+			buildHuffman(&lit, lengths, 288);
+			memset(lengths, 5, 30);
+			buildHuffman(&dist, lengths, 30);
+			if (!inflateBlock(z, &lit, &dist)) return 0;
+		} else if (type == 2) {                                                     // dynamic codes
+			static const uint8_t order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+			uint8_t lengths[320] = { 0 };
+			int nlen = getBits(z, 5) + 257, ndist = getBits(z, 5) + 1, ncode = getBits(z, 4) + 4;
+			if (ncode < 4 || nlen > 286 || ndist > 30) return 0;
+			for (int i = 0; i < ncode; i++) {
+				int len = getBits(z, 3);
+				if (len < 0) return 0;
+				lengths[order[i]] = len;
+			}
+			buildHuffman(&lit, lengths, 19);                                          // the code lengths code
+			for (int i = 0; i < nlen + ndist; ) {
+				int symbol = decodeSymbol(z, &lit), repeat, value = 0;
+				if (symbol < 0) return 0;
+				if (symbol < 16) {
+					lengths[i++] = symbol;
+					continue;
+				}
+				if (symbol == 16) {                                                     // repeat the previous length
+					if (!i) return 0;
+					value = lengths[i - 1];
+					repeat = 3 + getBits(z, 2);
+				} else if (symbol == 17) {
+					repeat = 3 + getBits(z, 3);
+				} else {
+					repeat = 11 + getBits(z, 7);
+				}
+				if (repeat < 3 || i + repeat > nlen + ndist) return 0;
+				while (repeat--) lengths[i++] = value;
+			}
+			buildHuffman(&lit, lengths, nlen);
+			buildHuffman(&dist, lengths + nlen, ndist);
+			if (!inflateBlock(z, &lit, &dist)) return 0;
+		} else {
+			return 0;                                                                 // invalid block type
+		}
+	} while (!last);
+	return z->outPos == z->outSize;
+}
+
+
+static uint8_t *inflateData(const uint8_t *in, long inSize, long outSize, int method) {
+	if (outSize <= 0 || outSize > 0x2000000) return NULL;                         // larger than any floppy image
+	struct inflater z = { in, inSize, 0, 0, 0, malloc(outSize), outSize, 0 };
+	if (!z.out) return NULL;                                                      // the load fails
+	if (method == 0 && inSize >= outSize) {                                       // zip entry without compression
+		memcpy(z.out, in, outSize);
+		return z.out;
+	}
+	if (method == 8 && inflateStream(&z)) return z.out;                           // deflated
+	free(z.out);
+	return NULL;
+}
+
+
+static uint8_t *unpackImage(uint8_t *file, long *size, char *name) {            // the uncompressed image, NULL if invalid
+	long n = *size;                                                               // name is updated to the inner file name
+
+	if (n > 18 && file[0] == 0x1F && file[1] == 0x8B && file[2] == 8) {           // gzip
+		long pos = 10;
+		if (file[3] & 4) pos += 2 + (file[10] | file[11] << 8);                     // FEXTRA
+		if (file[3] & 8) while (pos < n && file[pos++]);                            // FNAME
+		if (file[3] & 16) while (pos < n && file[pos++]);                           // FCOMMENT
+		if (file[3] & 2) pos += 2;                                                  // FHCRC
+		if (pos > n - 8) return NULL;
+		long isize = file[n - 4] | file[n - 3] << 8 | file[n - 2] << 16 | (long)file[n - 1] << 24;
+		unsigned int crc = file[n - 8] | file[n - 7] << 8 | file[n - 6] << 16 | (unsigned int)file[n - 5] << 24;
+		uint8_t *image = inflateData(file + pos, n - 8 - pos, isize, 8);
+		if (!image || crc32(image, isize) != crc) {
+			free(image);
+			return NULL;
+		}
+		if (hasExtension(name, ".gz")) name[strlen(name) - 3] = 0;                  // game.po.gz is a .po
+		*size = isize;
+		return image;
+	}
+
+	if (n > 22 && !memcmp(file, "PK\x03\x04", 4)) {                               // zip : look for the central directory
+		long end = n - 22;
+		while (end > 0 && memcmp(file + end, "PK\x05\x06", 4)) end--;
+		if (!end) return NULL;
+		long entries = file[end + 10] | file[end + 11] << 8;
+		long pos = file[end + 16] | file[end + 17] << 8 | file[end + 18] << 16 | (long)file[end + 19] << 24;
+
+		while (entries-- && pos + 46 <= n && !memcmp(file + pos, "PK\x01\x02", 4)) {
+			const uint8_t *e = file + pos;
+			int method = e[10] | e[11] << 8, nameLen = e[28] | e[29] << 8;
+			long csize = e[20] | e[21] << 8 | e[22] << 16 | (long)e[23] << 24;
+			long usize = e[24] | e[25] << 8 | e[26] << 16 | (long)e[27] << 24;
+			long local = e[42] | e[43] << 8 | e[44] << 16 | (long)e[45] << 24;
+			char entry[400];
+			snprintf(entry, sizeof(entry), "%.*s", pos + 46 + nameLen <= n ? nameLen : 0, (const char *)e + 46);
+			pos += 46 + nameLen + (e[30] | e[31] << 8) + (e[32] | e[33] << 8);
+
+			if (!hasExtension(entry, ".nib") && !hasExtension(entry, ".dsk") && !hasExtension(entry, ".do") &&
+			    !hasExtension(entry, ".po") && !hasExtension(entry, ".woz"))
+				continue;                                                               // the first disk image is taken
+			if (local + 30 > n || memcmp(file + local, "PK\x03\x04", 4)) return NULL;
+			long data = local + 30 + (file[local + 26] | file[local + 27] << 8) + (file[local + 28] | file[local + 29] << 8);
+			if (csize > n - data) return NULL;
+			uint8_t *image = inflateData(file + data, csize, usize, method);
+			if (!image) return NULL;
+			sprintf(name, "%s", entry);
+			*size = usize;
+			return image;
+		}
+		return NULL;
+	}
+
+	return file;                                                                  // not compressed
+}
+
+
+static void trackExtent(int drive, int t, long *offset, long *length) {         // where a track is stored in the image
+	struct drive *d = &disk[drive];
+	if (d->format == WOZ) {                                                       // the blocks of this TRK entry
+		*offset = (d->trks[t * 8] | d->trks[t * 8 + 1] << 8) * 512L;
+		*length = (d->trks[t * 8 + 2] | d->trks[t * 8 + 3] << 8) * 512L;
+	} else if (d->format == NIB) {
+		*offset = t * TRKSIZE;
+		*length = TRKSIZE;
+	} else {                                                                      // 16 sectors
+		*offset = t * 4096L;
+		*length = 4096;
+	}
+}
+
+
+static void deltaName(int drive, char *name) {                                  // compressed images changes go next to them
+	sprintf(name, "%s.delta", disk[drive].filename);
+}
+
+
+static void loadDelta(int drive) {                                              // reapply the changes of the previous sessions
+	struct drive *d = &disk[drive];
+	char name[420];
+	uint8_t record[8];
+	deltaName(drive, name);
+	FILE *f = fopen(name, "rb");
+	if (!f) return;
+
+	if (fread(record, 1, 8, f) == 8 && !memcmp(record, "R2DELTA1", 8)) {
+		while (fread(record, 1, 8, f) == 8) {                                       // offset and length, then the bytes
+			long offset = record[0] | record[1] << 8 | record[2] << 16 | (long)record[3] << 24;
+			long length = record[4] | record[5] << 8 | record[6] << 16 | (long)record[7] << 24;
+			if (offset > d->size || length > d->size - offset || fread(d->image + offset, 1, length, f) != length)
+				break;
+			for (int t = 0; t < WOZTRKS; t++) {                                       // these tracks have to be saved again
+				long start, size;
+				trackExtent(drive, t, &start, &size);
+				if (start == offset && size == length) d->changed[t] = true;
+			}
+		}
+	}
+	fclose(f);
+}
+
+
+static int saveDelta(int drive) {                                               // the whole delta file is rewritten
+	struct drive *d = &disk[drive];
+	char name[420];
+	deltaName(drive, name);
+	FILE *f = fopen(name, "wb");
+	if (!f) return 0;
+
+	bool success = fwrite("R2DELTA1", 1, 8, f) == 8;
+	for (int t = 0; t < WOZTRKS + 1; t++) {
+		long offset = 8, length = 4;                                                // WOZ header CRC, after the tracks
+		if (t < WOZTRKS) {
+			if (!d->changed[t]) continue;
+			trackExtent(drive, t, &offset, &length);
+		} else if (d->format != WOZ) {
+			break;
+		}
+		uint8_t record[8];
+		for (int i = 0; i < 4; i++) {
+			record[i] = offset >> (i * 8);
+			record[4 + i] = length >> (i * 8);
+		}
+		if (fwrite(record, 1, 8, f) != 8 || fwrite(d->image + offset, 1, length, f) != length) success = false;
+	}
+	if (fclose(f)) success = false;
+	return success;
+}
+
+
+int saveFloppy(int drive) {                                                     // writes back the dirty tracks only
+	struct drive *d = &disk[drive];
+	if (!d->filename[0]) return 0;                                                // no file loaded into drive
+	if (d->readOnly) return 0;                                                    // file is read only write no aptempted
+
+	int t = 0;
+	while (t < WOZTRKS && !d->dirty[t]) t++;
+	if (t == WOZTRKS) return 1;                                                   // nothing changed since the last save
+	forgetImage(d->filename);                                                     // the next insert reads the new content
+
+	if (d->format == WOZ) {                                                       // update the CRC of the header
+		unsigned int crc = crc32(d->image + 12, d->size - 12);
+		for (int i = 0; i < 4; i++) d->image[8 + i] = crc >> (i * 8);
+	}
+
+	FILE *f = d->compressed ? NULL : fopen(d->filename, "r+b");                   // update the file in place
+	if (!f && !d->compressed) return 0;
+
+	bool success = true;
+	for (; t < WOZTRKS; t++) {
+		if (!d->dirty[t]) continue;
+		if ((d->format == DO || d->format == PO) && !denibblizeTrack(drive, t)) {   // back to sector order
+			success = false;                                                          // a sector can't be decoded
+			continue;
+		}
+		long offset, length;
+		trackExtent(drive, t, &offset, &length);
+		if (f && (fseek(f, offset, SEEK_SET) || fwrite(d->image + offset, 1, length, f) != length)) {
+			success = false;                                                          // disk full ?
+			continue;
+		}
+		d->dirty[t] = false;
+		d->changed[t] = true;
+	}
+
+	if (!f) return saveDelta(drive) && success;                                   // a compressed image is never written
+	if (d->format == WOZ && (fseek(f, 8, SEEK_SET) || fwrite(d->image + 8, 1, 4, f) != 4))
+		success = false;
+	if (fclose(f)) success = false;                                               // release the ressource
+	return success;
+}
+
+
+static void ejectFloppy(int drv) {
+	if (disk[drv].format == DO || disk[drv].format == PO)                         // tracks were allocated one by one
+		for (int t = 0; t < TRACKS; t++) free(disk[drv].tracks[t]);
+	if (!disk[drv].shared || disk[drv].image != disk[drv].shared->image)
+		free(disk[drv].image);                                                      // its own copy
+	if (disk[drv].shared) {
+		LOCKIMAGES();
+		releaseImage(disk[drv].shared);
+		UNLOCKIMAGES();
+	}
+	disk[drv].shared = NULL;
+	memset(disk[drv].tracks, 0, sizeof(disk[drv].tracks));
+	memset(disk[drv].dirty, 0, sizeof(disk[drv].dirty));
+	memset(disk[drv].written, 0, sizeof(disk[drv].written));
+	memset(disk[drv].changed, 0, sizeof(disk[drv].changed));
+	disk[drv].saveFailed = false;
+	disk[drv].image = NULL;
+	disk[drv].filename[0] = 0;
+}
+
+
+static int loadFloppy(char *filename, int drv) {                                // the changes to the previous one are dropped
+	LOCKIMAGES();
+	struct sharedImage *shared = findImage(filename);                             // another drive already loaded it
+	if (shared) shared->users++;                                                  // even if it was in this drive
+	UNLOCKIMAGES();
+	char name[400];                                                               // the name tells the format too
+	snprintf(name, sizeof(name), "%s", filename);
+	uint8_t *image;
+	long size;
+	bool compressed;
+
+	if (shared) {
+		image = shared->image;
+		size = shared->size;
+		compressed = shared->compressed;
+	} else {
+		FILE *f = fopen(filename, "rb");                                            // open file in read binary mode
+		if (!f) return 0;
+		fseek(f, 0, SEEK_END);                                                      // the size tells the format
+		size = ftell(f);
+		rewind(f);
+
+		uint8_t *file = size >= 256 ? malloc(size) : NULL;
+		if (!file || fread(file, 1, size, f) != size) {                             // load it into memory
+			free(file);
+			fclose(f);
+			return 0;
+		}
+		fclose(f);
+
+		image = unpackImage(file, &size, name);                                     // gzip or zip files are inflated
+		compressed = image != file;
+		if (compressed) free(file);
+		if (!image) return 0;                                                       // a broken archive
+	}
+
+	bool woz = size >= 256 && !memcmp(image, "WOZ2", 4);
+	if (!woz && size != NIBSIZE && size != DSKSIZE) {
+		free(image);
+		return 0;
+	}
+
+	ejectFloppy(drv);
+	disk[drv].image = image;
+	disk[drv].size = size;
+	disk[drv].shared = shared;
+	if (woz) {
+		if (!loadWoz(drv, image, size)) {
+			ejectFloppy(drv);
+			return 0;
+		}
+	} else if (size == NIBSIZE) {
+		disk[drv].format = NIB;
+		for (int t = 0; t < TRACKS; t++)                                            // already nibblelized
+			disk[drv].tracks[t] = image + t * TRKSIZE;
+	} else if (shared) {
+		disk[drv].format = shared->format;
+	} else {
+		disk[drv].format = hasExtension(name, ".po") ? PO : DO;                     // tracks are nibblelized on first access
+	}
+
+	sprintf(disk[drv].filename, "%s", filename);                                  // update disk filename record
+	disk[drv].compressed = compressed;
+	if (shared) {
+		memcpy(disk[drv].changed, shared->changed, sizeof(disk[drv].changed));
+	} else {
+		if (compressed) loadDelta(drv);
+		disk[drv].shared = shareImage(drv);                                         // for the next drive inserting it
+	}
+	diskII[drv / 2].enabled = true;                                               // plug the controller in
+	plugCard(drv / 2 ? 5 : 6, &diskIICard);
+
+	FILE *f = compressed ? NULL : fopen(filename, "ab");                          // try to open the file in append binary mode
+	if (f || compressed) {                                                        // success, file is writable
+		disk[drv].readOnly = false;                                                 // update the readOnly flag
+		if (f) fclose(f);                                                           // and close it untouched
+	} else {
+		disk[drv].readOnly = true;                                                  // f is NULL, no writable, no need to close it
+	}
+	if (woz && image[22]) disk[drv].readOnly = true;                              // WOZ write protected flag
+	floppyInserted(drv);                                                          // the front end shows it
+
+	return 1;
+}
+
+
+int insertFloppy(char *filename, int drv) {
+	if (drv < 0 || drv >= DRIVES) return 0;
+	saveFloppy(drv);                                                              // keep the changes made to the previous one
+	return loadFloppy(filename, drv);
+}
+
+
+void flushFloppies() {                                                          // called between two frames
+	for (int drv = 0; drv < DRIVES; drv++) {
+		if (disk[drv].motorStop && disk[drv].motorStop <= ticks)                    // the motor might have stopped meanwhile
+			spinFloppy(drv);                                                          // (never split a spin otherwise : replays)
+		if (disk[drv].flush && !disk[drv].motorOn && !disk[drv].saveFailed) {       // the motor has stopped, write the changes
+			if (!disk[drv].filename[0] || disk[drv].readOnly || saveFloppy(drv)) {    // (nothing to write to)
+				disk[drv].flush = false;
+			} else {                                                                  // still dirty, the front end tells why
+				disk[drv].saveFailed = true;
+				floppyNotSaved(drv);
+			}
+		}
+	}
+}
+
+
+void stepMotor(int ctl, uint16_t address) {
+	int drv = diskII[ctl].curDrv;
+	bool *phases = diskII[ctl].phases[drv & 1];
+	int pos = disk[drv].halfTrack;                                                // the magnet facing the head is pos & 3
+
+	phases[(address >> 1) & 3] = address & 1;                                     // PHASE x ON / OFF
+
+	if (phases[(pos + 1) & 3] && !phases[(pos - 1) & 3] && pos < 68)
+		pos++;                                                                      // head is moving out, up to the last track
+	else if (phases[(pos - 1) & 3] && !phases[(pos + 1) & 3] && pos > 0)
+		pos--;                                                                      // head is moving in
+
+	disk[drv].halfTrack = pos;                                                    // update track#
+	disk[drv].track = (pos + 1) / 2;
+}
+
+
+inline static void setDrv(int drv) {                                            // drv and drv ^ 1 share a controller
+	int other = drv ^ 1;
+	spinFloppy(drv);                                                              // the floppies stop or start spinning
+	spinFloppy(other);
+	if (disk[other].motorOn) {                                                    // if any of the motors were ON
+		disk[drv].motorOn = true;
+		disk[drv].motorStop = disk[other].motorStop;                                // (the delay is handled by the controller)
+	}
+	disk[other].motorOn = false;                                                  // motor of the other drive is set to OFF
+	disk[other].flush = true;                                                     // so its changes can be written
+	disk[other].saveFailed = false;
+	diskII[drv / 2].curDrv = drv;                                                 // set the current drive
+}
+
+
+static void motorOff(int drv) {
+	spinFloppy(drv);
+	if (disk[drv].motorOn && !disk[drv].motorStop)                                // it keeps spinning for about a second
+		disk[drv].motorStop = ticks + CPUFREQ;
+	disk[drv].flush = true;                                                       // write back the changes once stopped
+	disk[drv].saveFailed = false;
+}
+
+
+bool disksSpinning() {                                                          // a selected drive motor is on
+	bool spinning = false;
+	for (int ctl = 0; ctl < CONTROLLERS; ctl++) {
+		int drv = diskII[ctl].curDrv;                                               // the motor might have stopped meanwhile
+		if (disk[drv].motorOn && !(disk[drv].motorStop && disk[drv].motorStop <= ticks))
+			spinning = true;
+	}
+	return spinning;
+}
+
+
+static uint8_t diskSwitches(int ctl, uint16_t address, uint8_t value) {         // $C0n0-$C0nF, n = slot + 8
+	int drv = diskII[ctl].curDrv;
+	struct drive *d = &disk[drv];
+	uint8_t *dLatch = &diskII[ctl].dLatch;
+
+	switch (address & 0x0F) {
+		case 0x0:
+		case 0x1:
+		case 0x2:
+		case 0x3:
+		case 0x4:
+		case 0x5:
+		case 0x6:
+		case 0x7: stepMotor(ctl, address); break;                                   // MOVE DRIVE HEAD
+
+		case 0x8: motorOff(drv); break;                                             // MOTOROFF
+		case 0x9: spinFloppy(drv);                                                  // MOTORON
+			d->motorOn = true;
+			d->motorStop = 0;
+			break;
+
+		case 0xA: setDrv(ctl * 2); break;                                           // DRIVE0EN
+		case 0xB: setDrv(ctl * 2 + 1); break;                                       // DRIVE1EN
+
+		case 0xC:                                                                   // Shift Data Latch
+			if (!d->image) return *dLatch;                                            // no floppy
+			if (d->format == WOZ) {                                                   // bit level, driven by the ticks
+				wozRun(drv, *dLatch);
+				return d->writeMode ? *dLatch : d->latch;
+			}
+			if (!d->tracks[d->track] && !nibblizeTrack(drv, d->track))                // first time the head is over this track
+				return *dLatch;                                                         // (no memory for it : no data)
+			spinFloppy(drv);                                                          // the nibble under the head depends on the time
+			uint8_t *nibbles = d->tracks[d->track];
+			if (d->writeMode) {                                                       // writting
+				nibbles[d->nibble] = *dLatch;
+				d->dirty[d->track] = d->written[d->track] = true;
+				return *dLatch;
+			}
+			int elapsed = ticks - d->nibbleTick;                                      // reading : the complete nibble
+			if (elapsed < 8)                                                          // stays for two bit cells
+				return *dLatch = nibbles[d->nibble];
+			uint8_t next = nibbles[(d->nibble + 1) % TRKSIZE];                        // then the next one shifts in
+			return *dLatch = next >> (8 - elapsed / 4);
+
+		case 0xD:                                                                   // Load Data Latch
+			if (d->format == WOZ && d->image) {
+				wozRun(drv, *dLatch);                                                   // the previous value is shifted out
+				d->writtenBits = 0;
+			}
+			*dLatch = value;
+			break;
+
+		case 0xE:                                                                   // latch for READ
+			if (d->format == WOZ && d->image) wozRun(drv, *dLatch);
+			spinFloppy(drv);
+			d->writeMode = false;
+			return d->readOnly ? 0x80 : 0;                                            // check protection
+
+		case 0xF:                                                                   // latch for WRITE
+			if (d->format == WOZ && d->image) wozRun(drv, *dLatch);
+			spinFloppy(drv);
+			if (!ownImage(drv)) break;                                                // the image is about to change
+			d->writeMode = true;
+			d->writtenBits = 8;                                                       // nothing to write until the next load
+			break;
+	}
+	return floatingBus();                                                         // catch all
+}
+
+
+//================================================================= DISK ][ HLE
+// DOS 3.3 RWTS calls and the boot PROM sector reads are served straight from
+// the image, the copy protected ones (.nib, .woz, modified RWTS) are left
+// to the low level emulation
+
+THREADLOCAL bool hleDisk = false;                                               // high level emulation of the disk accesses
+
+static const uint8_t rwtsCode[16] = {                                           // STY $48 STA $49 LDY #$02 STY $06F8 ...
+	0x84, 0x48, 0x85, 0x49, 0xA0, 0x02, 0x8C, 0xF8, 0x06, 0xA0, 0x04, 0x8C, 0xF8, 0x04, 0xA0, 0x01
+};
+
+static const uint8_t bootCode[9] = {                                            // CLC PHP LDA $C08C,X BPL EOR #$D5
+	0x18, 0x08, 0xBD, 0x8C, 0xC0, 0x10, 0xFB, 0x49, 0xD5
+};
+
+
+static uint8_t ramByte(uint16_t address) {                                      // below $C000, as the cpu reads it
+	return readPages[address >> 8][address & 0xFF];                               // (main or aux, without a trap)
+}
+
+
+static void setRamByte(uint16_t address, uint8_t value) {                       // and writes it
+	writePages[address >> 8][address & 0xFF] = value;
+}
+
+
+static void getRam(uint8_t *bytes, uint16_t address, int length) {              // the pages crossed may be in aux
+	for (int i = 0; i < length; i++) bytes[i] = ramByte(address + i);
+}
+
+
+static void putRam(uint16_t address, const uint8_t *bytes, int length) {
+	for (int i = 0; i < length; i++) setRamByte(address + i, bytes[i]);
+}
+
+
+static uint8_t *hleSector(int drv, int track, int physical) {                   // the sector in the image, NULL if unsure
+	struct drive *d = &disk[drv];
+	if (!d->image || (d->format != DO && d->format != PO) || track >= TRACKS) return NULL;
+	if (d->tracks[track] && d->dirty[track] && !denibblizeTrack(drv, track))
+		return NULL;                                                                // the nibbles were written with something else
+	return d->image + track * 4096 + skew[d->format][physical & 15] * 256;
+}
+
+
+static uint8_t rwtsTrap(uint16_t address) {                                     // opcode fetch at the RWTS entry point
+	puce6502Regs regs;
+	puce6502GetRegs(&regs);
+	uint16_t iob = regs.A << 8 | regs.Y;                                          // IOB address in A and Y
+	uint8_t code[16], io[17];
+	getRam(code, address, 16);
+	if (memcmp(code, rwtsCode, 16) || iob > RAMSIZE - 17) return code[0];
+
+	getRam(io, iob, 17);
+	uint16_t buffer = io[8] | io[9] << 8;
+	int ctl = io[1] == 0x60 ? 0 : io[1] == 0x50 && diskII[1].enabled ? 1 : -1;
+	int drv = ctl * 2 + io[2] - 1, track = io[4], logical = io[5], command = io[12];
+	if (ctl < 0 || io[2] < 1 || io[2] > 2 || buffer > RAMSIZE - 256 || logical > 15)
+		return code[0];                                                             // not one of our controllers
+	if ((command != 1 && command != 2) || (io[3] && io[3] != 254))
+		return code[0];                                                             // seek, format or volume mismatch
+	if (command == 2 && disk[drv].readOnly)
+		return code[0];                                                             // let RWTS report the protection
+
+	int physical = 0;                                                             // DOS logical order -> physical sector
+	while (skew[DO][physical] != logical) physical++;
+	uint8_t *sector = hleSector(drv, track, physical);
+	if (!sector) return code[0];
+
+	if (command == 1) {
+		putRam(buffer, sector, 256);                                                // READ
+	} else if (!ahead) {                                                          // WRITE (once the frame is for real)
+		if (!ownImage(drv)) return code[0];                                         // now write protected
+		sector = hleSector(drv, track, physical);                                   // the image may have moved
+		getRam(sector, buffer, 256);
+		free(disk[drv].tracks[track]);                                              // the nibbles are made again
+		nibblizeTrack(drv, track);
+		disk[drv].dirty[track] = disk[drv].written[track] = true;
+		disk[drv].flush = true;
+	}
+
+	setDrv(drv);                                                                  // RWTS selects the drive
+	motorOff(drv);                                                                // and stops the motor when done
+	io[13] = 0;                                                                   // no error
+	io[14] = 254;                                                                 // volume found
+	io[15] = io[1];                                                               // previous slot and drive
+	io[16] = io[2];
+	putRam(iob + 13, io + 13, 4);
+	regs.A = 0;
+	regs.X = io[1];
+	regs.Y = 13;
+	regs.P &= ~0x01;                                                              // carry clear
+	puce6502SetRegs(&regs);
+	return 0x60;                                                                  // the cpu executes a RTS instead
+}
+
+
+static uint8_t bootTrap(int ctl) {                                              // opcode fetch at $Cn5C, read sectors
+	if (memcmp(sl6 + 0x5C, bootCode, 9)) return sl6[0x5C];
+
+	int drv = diskII[ctl].curDrv;
+	do {                                                                          // until the count found at $0800
+		uint16_t buffer = ramByte(0x26) | ramByte(0x27) << 8;
+		uint8_t *sector = hleSector(drv, disk[drv].track, ramByte(0x3D));           // sector $3D under the head
+		if (!sector || buffer > RAMSIZE - 256) return sl6[0x5C];                    // the PROM will do it
+		putRam(buffer, sector, 256);
+		setRamByte(0x27, ramByte(0x27) + 1);
+		setRamByte(0x3D, ramByte(0x3D) + 1);
+	} while (ramByte(0x3D) < ramByte(0x800));
+
+	puce6502Regs regs;
+	puce6502GetRegs(&regs);
+	regs.A = ramByte(0x3D);
+	regs.X = ramByte(0x2B);                                                       // slot * 16
+	regs.PC = 0x801;                                                              // JMP $0801
+	puce6502SetRegs(&regs);
+	return 0xEA;                                                                  // the cpu executes a NOP instead
+}
+
+
+//==================================================================== HARD DISK
+// a ProDOS block device in slot 7, its firmware is a stub whose boot code and
+// driver entry point are trapped by readMem
+
+#define HDDMAX   65535                                                          // blocks of 512 bytes, 32MB
+
+static const uint8_t sl7[256] = {
+	[0x00] = 0xA2, [0x01] = 0x20, [0x02] = 0xA0, [0x03] = 0x00,                   // LDX #$20 LDY #$00
+	[0x04] = 0xA2, [0x05] = 0x03, [0x06] = 0xA2, [0x07] = 0x3C,                   // LDX #$03 LDX #$3C : a block device
+	[0x08] = 0x60,                                                                // boot code, trapped
+	[0x10] = 0x60,                                                                // driver entry point, trapped
+	[0xFE] = 0x8F,                                                                // removable, format, write, read and status
+	[0xFF] = 0x10                                                                 // driver entry point offset
+};
+
+THREADLOCAL struct hardDisk hdd = { 0 };
+
+
+int saveHardDisk() {                                                            // writes back the dirty blocks only
+	if (!hdd.image || hdd.readOnly) return 0;
+
+	long b = 0;
+	while (b < hdd.blocks && !hdd.dirty[b]) b++;
+	if (b == hdd.blocks) return 1;                                                // nothing changed since the last save
+
+	FILE *f = fopen(hdd.filename, "r+b");                                         // update the file in place
+	if (!f) return 0;
+	bool success = true;
+	for (; b < hdd.blocks; b++) {
+		if (!hdd.dirty[b]) continue;
+		if (fseek(f, b * 512, SEEK_SET) || fwrite(hdd.image + b * 512, 1, 512, f) != 512) {
+			success = false;                                                          // disk full ?
+			continue;
+		}
+		hdd.dirty[b] = false;
+	}
+	if (fclose(f)) success = false;
+	return success;
+}
+
+
+static void dropHardDisk() {                                                    // without saving it
+	free(hdd.image);
+	free(hdd.base);
+	free(hdd.dirty);
+	free(hdd.written);
+	hdd = (struct hardDisk){ 0 };
+}
+
+
+void ejectHardDisk() {
+	saveHardDisk();
+	dropHardDisk();
+}
+
+
+static int loadHardDisk(char *filename) {                                       // the changes to the previous one are dropped
+	if (!hasExtension(filename, ".hdv") && !hasExtension(filename, ".po")) return 0;
+
+	FILE *f = fopen(filename, "r+b");
+	bool readOnly = !f;
+	if (!f && !(f = fopen(filename, "rb"))) return 0;                             // not writable, or not there
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+
+	if (!size || size % 512 || size / 512 > HDDMAX || (size == DSKSIZE && hasExtension(filename, ".po"))) {
+		fclose(f);                                                                  // not for this card
+		return 0;
+	}
+	uint8_t *image = malloc(size);
+	bool *dirty = calloc(size / 512, sizeof(bool)), *written = calloc(size / 512, sizeof(bool));
+	if (!image || !dirty || !written || fread(image, 1, size, f) != size) {
+		free(image);
+		free(dirty);
+		free(written);
+		fclose(f);
+		return 0;
+	}
+	fclose(f);                                                                    // written back on save only
+
+	dropHardDisk();
+	hdd.image = image;
+	hdd.blocks = size / 512;
+	hdd.dirty = dirty;
+	hdd.written = written;
+	hdd.readOnly = readOnly;
+	sprintf(hdd.filename, "%s", filename);
+	return 1;
+}
+
+
+int insertHardDisk(char *filename) {                                            // .hdv, or .po larger than a floppy
+	saveHardDisk();                                                               // keep the changes made to the previous one
+	return loadHardDisk(filename);
+}
+
+
+static void keepBase() {                                                        // the image as loaded, before its first change
+	if (hdd.base || !(hdd.base = malloc(hdd.blocks * 512))) return;               // (the states can't undo the writes without)
+	memcpy(hdd.base, hdd.image, hdd.blocks * 512);
+}
+
+
+static uint8_t hardDiskBoot() {                                                 // opcode fetch at $C708
+	puce6502Regs regs;
+	puce6502GetRegs(&regs);
+	if (runAddress >= 0) {                                                        // a binary is run instead
+		regs.PC = runAddress;
+		runAddress = -1;
+	} else if (hdd.image) {                                                       // load block 0 at $0800
+		putRam(0x800, hdd.image, 512);
+		regs.X = 0x70;                                                              // slot * 16
+		regs.PC = 0x801;
+	} else {                                                                      // no image, try the next slot
+		setRamByte(0x00, 0x00);
+		setRamByte(0x01, 0xC7);
+		regs.PC = 0xFABA;                                                           // Autostart ROM slot scan loop
+	}
+	puce6502SetRegs(&regs);
+	return 0xEA;                                                                  // the cpu executes a NOP instead
+}
+
+
+static uint8_t hardDiskCall() {                                                 // opcode fetch at $C710, ProDOS driver call
+	int command = ramByte(0x42);                                                  // parameters are in page zero
+	long block = ramByte(0x46) | ramByte(0x47) << 8;
+	uint16_t buffer = ramByte(0x44) | ramByte(0x45) << 8;
+	uint8_t error = 0;
+
+	puce6502Regs regs;
+	puce6502GetRegs(&regs);
+	if (!hdd.image || (ramByte(0x43) & 0x80))                                     // drive 2 is never there
+		error = 0x28;                                                               // NO DEVICE CONNECTED
+	else if (command == 0) {                                                      // STATUS : the number of blocks in X and Y
+		regs.X = hdd.blocks & 0xFF;
+		regs.Y = hdd.blocks >> 8;
+	} else if (command > 3 || block >= hdd.blocks || buffer > RAMSIZE - 512)
+		error = 0x27;                                                               // I/O ERROR
+	else if (command == 1)
+		putRam(buffer, hdd.image + block * 512, 512);                               // READ
+	else if (hdd.readOnly)
+		error = 0x2B;                                                               // WRITE PROTECTED
+	else if (command == 2 && !ahead) {                                            // WRITE (once the frame is for real)
+		keepBase();
+		getRam(hdd.image + block * 512, buffer, 512);
+		hdd.written[block] = true;
+		if (movie.mode != PLAYING) hdd.dirty[block] = true;                         // saved on eject, a replay never is
+	}                                                                             // FORMAT has nothing to do
+
+	regs.A = error;
+	regs.P = error ? regs.P | 0x01 : regs.P & ~0x01;                              // carry set on error
+	puce6502SetRegs(&regs);
+	return 0x60;                                                                  // the cpu executes a RTS instead
+}
+
+
+//=============================================================== LANGUAGE CARD
+// 16K of RAM behind the ROM : two 4K banks in $D000-$DFFF and 8K in
+// $E000-$FFFF. A Saturn card holds up to eight of these 16K, selected by
+// $C084-$C087 and $C08C-$C08F. The cpu sees $D000-$FFFF through the page
+// tables, only updated when a switch changes what is there
+
+THREADLOCAL uint8_t *readPages[256];                                            // of the cpu, NULL for the I/O space
+THREADLOCAL uint8_t *writePages[256];                                           // NULL for the I/O space and the ROM
+THREADLOCAL struct saturn saturn = { 1, 0, NULL };
+
+
+uint8_t *languageRam(uint16_t address) {                                        // in the banks selected, $D000-$FFFF
+	bool low = LCBK2 && address < 0xE000;
+	if (ALTZP)
+		return low ? aux + 0xC000 + address - BK2START : aux + address;             // the //e aux one, bank 2 in $C000
+	if (!saturn.bank)
+		return low ? bk2 + address - BK2START : lgc + address - LGCSTART;           // the card's own 16K
+	uint8_t *bank = saturn.extra + (saturn.bank - 1) * SATURNBANK;
+	return low ? bank + LGCSIZE + address - BK2START : bank + address - LGCSTART;
+}
+
+
+static void mapLanguageCard() {                                                 // $D000-$FFFF, after a switch
+	for (int page = ROMSTART >> 8; page < 0x100; page++) {
+		uint8_t *lc = languageRam(page << 8);
+		readPages[page] = LCRD ? lc : apple2e ? romIIe + (page << 8) - 0xC000 : rom + (page << 8) - ROMSTART;
+		writePages[page] = LCWR ? lc : NULL;
+	}
+}
+
+
+int setLanguageCard(int kilobytes) {                                            // 16 for a plain card, up to 128
+	int banks = kilobytes / 16;
+	if (kilobytes % 16 || banks < 1 || banks > 8 || (banks & (banks - 1))) return 0;
+	uint8_t *extra = NULL;
+	if (banks > 1 && !(extra = calloc(banks - 1, SATURNBANK))) return 0;
+
+	free(saturn.extra);
+	saturn = (struct saturn){ banks, 0, extra };
+	plugCard(0, banks > 1 ? &saturnCard : &languageCard);
+	mapLanguageCard();
+	return 1;
+}
+
+
+static uint8_t languageSwitches(int slot, uint16_t address, uint8_t value, bool WRT) {
+	bool rd = LCRD, wr = LCWR, bk = LCBK2;
+	switch (address & 0x0F) {
+		case 0x0:
+		case 0x4: LCBK2 = 1; LCRD = 1; LCWR = 0;      LCWFF = 0;    break;          // LC2RD
+		case 0x1:
+		case 0x5: LCBK2 = 1; LCRD = 0; LCWR |= LCWFF; LCWFF = !WRT; break;          // LC2WR
+		case 0x2:
+		case 0x6: LCBK2 = 1; LCRD = 0; LCWR = 0;      LCWFF = 0;    break;          // ROMONLY2
+		case 0x3:
+		case 0x7: LCBK2 = 1; LCRD = 1; LCWR |= LCWFF; LCWFF = !WRT; break;          // LC2RW
+		case 0x8:
+		case 0xC: LCBK2 = 0; LCRD = 1; LCWR = 0;      LCWFF = 0;    break;          // LC1RD
+		case 0x9:
+		case 0xD: LCBK2 = 0; LCRD = 0; LCWR |= LCWFF; LCWFF = !WRT; break;          // LC1WR
+		case 0xA:
+		case 0xE: LCBK2 = 0; LCRD = 0; LCWR = 0;      LCWFF = 0;    break;          // ROMONLY1
+		case 0xB:
+		case 0xF: LCBK2 = 0; LCRD = 1; LCWR |= LCWFF; LCWFF = !WRT; break;          // LC1RW
+	}
+	if (LCRD != rd || LCWR != wr || LCBK2 != bk) mapLanguageCard();
+	return floatingBus();
+}
+
+
+static uint8_t saturnSwitches(int slot, uint16_t address, uint8_t value, bool WRT) {
+	if (!(address & 0x04)) return languageSwitches(slot, address, value, WRT);
+	saturn.bank = ((address & 0x03) | (address & 0x08) >> 1) & (saturn.banks - 1); // 16K bank select
+	mapLanguageCard();
+	return floatingBus();
+}
+
+
+//==================================================================== APPLE //E
+// 64K of auxiliary memory, switched in by the MMU for the zero page, the stack
+// and the language card (ALTZP), for $0200-$BFFF (RAMRD and RAMWRT) or, with
+// 80STORE, for the display pages selected by PAGE2 : all through the page
+// tables, rebuilt when one of these switches changes. The 16K rom holds the
+// firmware of $C100-$CFFF, the 80 columns one in $C300 and $C800-$CFFF
+
+static void mapMemory() {                                                       // the whole address space
+	for (int page = 0; page < RAMSIZE >> 8; page++) {
+		bool readAux = RAMRD, writeAux = RAMWRT;
+		if (page < 0x02)
+			readAux = writeAux = ALTZP;                                               // zero page and stack
+		else if (STORE80 && ((page >= 0x04 && page < 0x08) || (HIRES && page >= 0x20 && page < 0x40)))
+			readAux = writeAux = PAGE2;                                               // the display pages
+		readPages[page] = (readAux ? aux : ram) + (page << 8);
+		writePages[page] = (writeAux ? aux : ram) + (page << 8);
+	}
+	for (int page = RAMSIZE >> 8; page < ROMSTART >> 8; page++)
+		readPages[page] = writePages[page] = NULL;
+	mapLanguageCard();
+}
+
+
+static void resetSwitches() {                                                   // as the //e RESET line does
+	STORE80 = RAMRD = RAMWRT = INTCXROM = ALTZP = SLOTC3ROM = false;
+	COL80 = ALTCHAR = DHIRES = INTC8ROM = false;
+	LCRD = LCWFF = false;
+	LCWR = LCBK2 = true;
+	mapMemory();
+}
+
+
+//================================================================ BINARY FILES
+// loaded straight into memory, at the given address or the one of their
+// header : DOS 3.3 B file, AppleSingle, or a CiderPress name ending in #06AAAA.
+// A binary to run is jumped to by the boot code, the Monitor initialized
+
+THREADLOCAL long runAddress = -1;                                               // instead of booting, -1 to boot
+
+
+static long headerAddress(const char *filename, uint8_t **data, long *size) {   // -1 if none found
+	uint8_t *file = *data;
+	if (*size >= 26 && file[0] == 0x00 && file[1] == 0x05 && file[2] == 0x16 && file[3] == 0x00) {
+		long address = -1, entries = file[24] << 8 | file[25];                      // AppleSingle, big endian
+		uint8_t *fork = NULL;
+		long forkSize = 0;
+		for (long e = 0; e < entries && 26 + e * 12 + 12 <= *size; e++) {
+			uint8_t *entry = file + 26 + e * 12;
+			long id = entry[0] << 24 | entry[1] << 16 | entry[2] << 8 | entry[3];
+			long offset = (long)entry[4] << 24 | entry[5] << 16 | entry[6] << 8 | entry[7];
+			long length = (long)entry[8] << 24 | entry[9] << 16 | entry[10] << 8 | entry[11];
+			if (offset < 0 || length < 0 || offset + length > *size) continue;
+			if (id == 1) {                                                            // the data fork
+				fork = file + offset;
+				forkSize = length;
+			}
+			if (id == 11 && length >= 8)                                              // ProDOS file info : the aux type
+				address = file[offset + 6] << 8 | file[offset + 7];
+		}
+		if (!fork) return -1;
+		*data = fork;
+		*size = forkSize;
+		return address;
+	}
+
+	const char *hash = strrchr(filename, '#');                                    // CiderPress : type, then aux type
+	if (hash && strlen(hash) == 7 && strspn(hash + 1, "0123456789abcdefABCDEF") == 6)
+		return strtol(hash + 3, NULL, 16);
+
+	if (*size >= 4) {                                                             // DOS 3.3 : address, then length
+		long length = file[2] | file[3] << 8;
+		if (length && 4 + length <= *size && *size - 4 - length < 256) {            // maybe up to the end of a sector
+			*data = file + 4;
+			*size = length;
+			return file[0] | file[1] << 8;
+		}
+	}
+	return -1;
+}
+
+
+long loadBinary(char *filename, long address) {                                 // address -1 : from the header
+	FILE *f = fopen(filename, "rb");                                              // the address used, -1 if not loaded
+	if (!f) return -1;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+	uint8_t *file = size > 0 ? malloc(size) : NULL;
+	if (!file || fread(file, 1, size, f) != size) {
+		free(file);
+		fclose(f);
+		return -1;
+	}
+	fclose(f);
+
+	uint8_t *data = file;
+	long found = headerAddress(filename, &data, &size);                           // the header is never loaded
+	if (address < 0) address = found;                                             // and its address can be overridden
+	if (address < 0 || address + size > 0x10000 || (address < 0xD000 && address + size > RAMSIZE)) {
+		free(file);                                                                 // no address, or over the I/O space
+		return -1;
+	}
+
+	for (long i = 0; i < size; i++) {
+		long a = address + i;
+		if (a < RAMSIZE)
+			ram[a] = data[i];                                                         // RAM
+		else
+			*languageRam(a) = data[i];                                                // or the Language Card RAM
+	}
+	if (address < RAMSIZE)
+		movieMemory(address, (address + size < RAMSIZE ? address + size : RAMSIZE) - address);
+	free(file);
+	return address;
+}
+
+
+long loadSegment(char *argument) {                                              // FILE, or FILE@ADDR (hex)
+	char filename[400];
+	long address = -1;
+	char *at = strrchr(argument, '@');
+	if (at && at[1] && strspn(at + 1 + (at[1] == '$'), "0123456789abcdefABCDEF") == strlen(at + 1 + (at[1] == '$'))) {
+		address = strtol(at + 1 + (at[1] == '$'), NULL, 16);
+		snprintf(filename, sizeof(filename), "%.*s", (int)(at - argument), argument);
+	} else {
+		snprintf(filename, sizeof(filename), "%s", argument);
+	}
+	return loadBinary(filename, address);
+}
+
+
+//======================================================================== SLOTS
+// a card answers to its device select $C0n0-$C0nF (n = slot + 8) and to its
+// I/O select $Cn00-$CnFF, which also gives it $C800-$CFFE until $CFFF is
+// accessed. The $C000-$CFFF pages are dispatched by a table, and the slots by
+// the cards plugged in : empty slots only return the floating bus
+
+static uint8_t diskIISwitches(int slot, uint16_t address, uint8_t value, bool WRT) {
+	return diskSwitches(slot == 5, address, value);
+}
+
+
+static uint8_t diskIIRom(int slot, uint16_t address, uint8_t value, bool WRT) {
+	if ((address & 0xFF) == 0x5C && hleDisk && getPC() == address + 1)
+		return bootTrap(slot == 5);                                                 // opcode fetch of the PROM sector read
+	return sl6[address & 0xFF];
+}
+
+
+static uint8_t hardDiskRom(int slot, uint16_t address, uint8_t value, bool WRT) {
+	if ((address & 0xFF) == 0x08 && getPC() == address + 1) return hardDiskBoot();
+	if ((address & 0xFF) == 0x10 && getPC() == address + 1) return hardDiskCall();
+	return sl7[address & 0xFF];
+}
+
+
+const struct card languageCard = { languageSwitches, NULL, NULL };
+const struct card saturnCard = { saturnSwitches, NULL, NULL };
+const struct card diskIICard = { diskIISwitches, diskIIRom, NULL };
+const struct card hardDiskCard = { NULL, hardDiskRom, NULL };
+
+THREADLOCAL const struct card *slots[8] = { &languageCard, [6] = &diskIICard, [7] = &hardDiskCard };
+THREADLOCAL int expansionSlot = 0;
+
+
+void plugCard(int slot, const struct card *card) {
+	slots[slot & 7] = card;
+	if (expansionSlot == (slot & 7)) expansionSlot = 0;                           // its rom is gone
+}
+
+
+static uint8_t deviceSelect(uint16_t address, uint8_t value, bool WRT) {        // $C080-$C0FF
+	int slot = (address >> 4) & 7;
+	if (!slots[slot] || !slots[slot]->io) return floatingBus();
+	return slots[slot]->io(slot, address, value, WRT);
+}
+
+
+static uint8_t ioSelect(uint16_t address, uint8_t value, bool WRT) {            // $C100-$C7FF
+	int slot = (address >> 8) & 7;
+	if (apple2e && (INTCXROM || (slot == 3 && !SLOTC3ROM))) {                     // the //e firmware
+		if (slot == 3) INTC8ROM = true;                                             // with its $C800-$CFFF part
+		return romIIe[address - 0xC000];
+	}
+	if (!slots[slot]) return floatingBus();
+	if (slots[slot]->expansion) expansionSlot = slot;                             // the card takes $C800-$CFFE
+	return slots[slot]->rom ? slots[slot]->rom(slot, address, value, WRT) : floatingBus();
+}
+
+
+static uint8_t expansionRom(uint16_t address, uint8_t value, bool WRT) {        // $C800-$CFFF
+	if (address == 0xCFFF) {                                                      // deselects every expansion rom
+		expansionSlot = 0;
+		INTC8ROM = false;
+	} else if (INTCXROM || INTC8ROM)
+		return romIIe[address - 0xC000];                                            // the //e firmware
+	else if (expansionSlot && slots[expansionSlot])
+		return slots[expansionSlot]->expansion(expansionSlot, address, value, WRT);
+	return floatingBus();
+}
+
+
+//============================================================== VIDEX VIDEOTERM
+// an 80 columns card for the II plus, in slot 3 : a 6845 CRTC whose registers
+// are at $C0B0 (select) and $C0B1 (data), a 1K firmware in $C300 and
+// $C800-$CBFF, and 2K of screen ram seen 512 bytes at a time in $CC00-$CDFF,
+// the bank being picked by bits 2 and 3 of any $C0Bx access. Its screen is
+// shown instead of the 40 columns one in TEXT mode while AN0 is on. The rows
+// written since the last frame are marked, the front ends only redraw those
+
+uint8_t videxRom[VIDEXROMSIZE];                                                 // shared by the machines
+uint8_t videxFont[VIDEXFONTSIZE];
+THREADLOCAL struct videx videx = { .dirty = VIDEXALLROWS };
+
+
+static uint16_t videxAddress(int row, int col) {                                // in the screen ram
+	return ((videx.crtc[12] << 8 | videx.crtc[13]) + row * videx.crtc[1] + col) & (VIDEXRAMSIZE - 1);
+}
+
+
+static int videxRow(uint16_t address) {                                         // the one showing this byte, or -1
+	if (!videx.crtc[1]) return -1;
+	int pos = (address - videxAddress(0, 0)) & (VIDEXRAMSIZE - 1);
+	return pos / videx.crtc[1] < VIDEXROWS ? pos / videx.crtc[1] : -1;
+}
+
+
+static void videxTouch(uint16_t address) {                                      // this byte needs a redraw
+	int row = videxRow(address);
+	if (row >= 0) videx.dirty |= 1ul << row;
+}
+
+
+static uint16_t videxCursor() {                                                 // R14 and R15
+	return (videx.crtc[14] << 8 | videx.crtc[15]) & (VIDEXRAMSIZE - 1);
+}
+
+
+static bool videxBlink() {                                                      // the cursor shows, from R10
+	switch ((videx.crtc[10] >> 5) & 3) {
+		case 0:  return true;                                                       // steady
+		case 1:  return false;                                                      // none
+		case 2:  return ((ticks / FRAMECYCLES) & 8) != 0;                           // 1/16 of the field rate
+		default: return ((ticks / FRAMECYCLES) & 16) != 0;                          // 1/32
+	}
+}
+
+
+static uint8_t videxSwitches(int slot, uint16_t address, uint8_t value, bool WRT) {
+	videx.bank = (address >> 2) & 3;                                              // of the $CC00-$CDFF window
+	if (!(address & 1)) {                                                         // $C0B0 address register
+		if (WRT) videx.reg = value & 0x1F;
+		return floatingBus();
+	}
+	if (!WRT)                                                                     // $C0B1 data register
+		return videx.reg >= 14 && videx.reg < 18 ? videx.crtc[videx.reg] : 0;       // cursor and light pen only
+	if (videx.reg == 14 || videx.reg == 15) {                                     // the cursor moves
+		videxTouch(videxCursor());
+		videx.crtc[videx.reg] = value;
+		videxTouch(videxCursor());
+	} else if (videx.reg < 14) {                                                  // the geometry, or the start address
+		videx.crtc[videx.reg] = value;
+		videx.dirty = VIDEXALLROWS;
+	}
+	return floatingBus();
+}
+
+
+static uint8_t videxSlotRom(int slot, uint16_t address, uint8_t value, bool WRT) {
+	return videxRom[0x300 + (address & 0xFF)];                                    // $C300 is the last page of the rom
+}
+
+
+static uint8_t videxExpansion(int slot, uint16_t address, uint8_t value, bool WRT) {
+	if (address < 0xCC00) return videxRom[address & 0x3FF];
+	if (address >= 0xCE00) return floatingBus();
+	uint16_t offset = videx.bank * 0x200 + (address & 0x1FF);
+	if (WRT) {
+		videx.ram[offset] = value;
+		videxTouch(offset);
+	}
+	return videx.ram[offset];
+}
+
+
+const struct card videxCard = { videxSwitches, videxSlotRom, videxExpansion };
+
+
+static bool romLoaded(const uint8_t *rom, int size) {                           // not all zeros
+	for (int i = 0; i < size; i++)
+		if (rom[i]) return true;
+	return false;
+}
+
+
+int setVidex(bool on) {                                                         // 0 if its roms were not loaded
+	if (on && !(romLoaded(videxRom, VIDEXROMSIZE) && romLoaded(videxFont, VIDEXFONTSIZE))) return 0;
+	videx = (struct videx){ .dirty = VIDEXALLROWS };
+	plugCard(3, on ? &videxCard : NULL);
+	return 1;
+}
+
+
+bool videxShown() {                                                             // instead of the 40 columns text
+	return slots[3] == &videxCard && TEXT && AN0;
+}
+
+
+unsigned long videxRows() {                                                     // to redraw, one bit per row
+	bool blink = videxBlink();
+	if (blink != videx.blink) videxTouch(videxCursor());                          // the cursor row
+	videx.blink = blink;
+	unsigned long rows = videx.dirty;
+	videx.dirty = 0;
+	return rows;
+}
+
+
+uint8_t videxDots(int row, int line, int col) {                                 // 8 dots of a glyph, bit 7 on the left
+	if (row >= videx.crtc[6] || line > (videx.crtc[9] & 0x1F) || col >= videx.crtc[1]) return 0;
+	uint16_t address = videxAddress(row, col);
+	uint8_t glyph = videx.ram[address];
+	uint8_t dots = videxFont[(glyph & 0x7F) * 16 + line];
+	if (glyph & 0x80) dots = ~dots;                                               // inverse, as the alternate rom
+	if (address == videxCursor() && line >= (videx.crtc[10] & 0x1F) && line <= (videx.crtc[11] & 0x1F) && videxBlink())
+		dots = ~dots;
+	return dots;
+}
+
+
+//============================================================ SUPER SERIAL CARD
+// a 6551 ACIA in slot 2, its registers in $C0A8-$C0AB and its DIP switches in
+// $C0A1-$C0A2. The bytes go to and come from the host through two lock-free
+// rings, emptied and filled by a thread reading and writing a pty or a Unix
+// socket. The cpu runs in short slices while the card is plugged : in between,
+// a byte is received or sent at the programmed baud rate, and the IRQ line is
+// checked. Without a free byte in the ring, the transmitter stays busy
+
+#define RDRF    0x08                                                            // status : a byte was received
+#define TDRE    0x10                                                            // status : the transmitter is ready
+#define NODCD   0x60                                                            // status : no carrier, no data set ready
+#define IRQFLAG 0x80                                                            // status : the ACIA interrupts
+#define SERIALSLICE 64                                                          // cycles between two checks, 1/8 of a byte at 19200 baud
+#define RINGSIZE 4096                                                           // bytes, a power of 2
+
+uint8_t sscRom[SSCROMSIZE];                                                     // shared by the machines
+static bool sscFirmware = false;                                                // sscRom was loaded
+THREADLOCAL struct acia acia = { .status = TDRE };
+
+static const int baudRates[16] = {                                              // control register bits 0-3
+	115200, 50, 75, 110, 135, 150, 300, 600, 1200, 1800, 2400, 3600, 4800, 7200, 9600, 19200
+};
+
+#ifdef __unix__
+
+struct ring {                                                                   // one producer, one consumer
+	uint8_t      data[RINGSIZE];
+	atomic_uint  head, tail;                                                      // written by the producer, by the consumer
+};
+
+static struct {
+	int          fd, slave;                                                       // the pty master or the socket, -1 if none
+	char         name[400];                                                       // the pty slave to open, or the socket
+	struct ring  rx, tx;                                                          // host to Apple, Apple to host
+	atomic_bool  open, stop;                                                      // the host end is connected, the thread must end
+	pthread_t    thread;
+} bridge = { .fd = -1, .slave = -1 };
+
+
+static bool ringPut(struct ring *r, uint8_t byte) {                             // by the producer only
+	unsigned int head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == RINGSIZE) return false;
+	r->data[head % RINGSIZE] = byte;
+	atomic_store_explicit(&r->head, head + 1, memory_order_release);
+	return true;
+}
+
+
+static bool ringGet(struct ring *r, uint8_t *byte) {                            // by the consumer only
+	unsigned int tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	if (atomic_load_explicit(&r->head, memory_order_acquire) == tail) return false;
+	*byte = r->data[tail % RINGSIZE];
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+	return true;
+}
+
+
+static unsigned int ringCount(struct ring *r) {
+	return atomic_load_explicit(&r->head, memory_order_acquire) - atomic_load_explicit(&r->tail, memory_order_acquire);
+}
+
+
+static void *bridgeThread(void *unused) {                                       // services the rings, off the cpu thread
+	uint8_t buffer[512];
+	while (!atomic_load(&bridge.stop)) {
+		bool sending = ringCount(&bridge.tx) > 0;
+		bool room = ringCount(&bridge.rx) < RINGSIZE - sizeof(buffer);              // or the host waits
+		struct pollfd p = { bridge.fd, (room ? POLLIN : 0) | (sending ? POLLOUT : 0), 0 };
+		if (poll(&p, 1, 2) < 0) continue;                                           // 2 ms at most, for new bytes to send
+		if (p.revents & POLLIN) {
+			ssize_t n = read(bridge.fd, buffer, sizeof(buffer));
+			if (n <= 0) break;                                                        // the socket was closed
+			for (ssize_t i = 0; i < n; i++) ringPut(&bridge.rx, buffer[i]);
+		}
+		if (p.revents & POLLOUT) {
+			int n = 0;
+			while (n < (int)sizeof(buffer) && ringGet(&bridge.tx, &buffer[n])) n++;
+			for (int done = 0, w; done < n; done += w)
+				if ((w = write(bridge.fd, buffer + done, n - done)) <= 0) break;        // lost if the host end is gone
+		}
+		if (p.revents & (POLLERR | POLLHUP) && !(p.revents & POLLIN)) break;
+	}
+	atomic_store(&bridge.open, false);
+	return NULL;
+}
+
+
+static int openPty() {                                                          // the master, the slave name in bridge.name
+	int fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (fd < 0) return -1;
+	const char *name = grantpt(fd) || unlockpt(fd) ? NULL : ptsname(fd);
+	if (!name) {
+		close(fd);
+		return -1;
+	}
+	snprintf(bridge.name, sizeof(bridge.name), "%s", name);
+	bridge.slave = open(name, O_RDWR | O_NOCTTY);                                 // kept open : no hangup between two clients
+	struct termios t;
+	if (bridge.slave >= 0 && !tcgetattr(bridge.slave, &t)) {                      // raw bytes, no echo
+		t.c_iflag &= ~(IGNBRK | BRKINT | PARMRK | ISTRIP | INLCR | IGNCR | ICRNL | IXON);
+		t.c_oflag &= ~OPOST;
+		t.c_lflag &= ~(ECHO | ECHONL | ICANON | ISIG | IEXTEN);
+		t.c_cflag = (t.c_cflag & ~(CSIZE | PARENB)) | CS8;
+		tcsetattr(bridge.slave, TCSANOW, &t);
+	}
+	return fd;
+}
+
+
+static int openSocket(const char *path) {                                       // connected to a listening Unix socket
+	struct sockaddr_un address = { .sun_family = AF_UNIX };
+	if (strlen(path) >= sizeof(address.sun_path)) return -1;
+	strcpy(address.sun_path, path);
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd >= 0 && connect(fd, (struct sockaddr *)&address, sizeof(address))) {
+		close(fd);
+		return -1;
+	}
+	snprintf(bridge.name, sizeof(bridge.name), "%s", path);
+	return fd;
+}
+
+
+void closeSerial() {
+	if (bridge.fd < 0) return;
+	atomic_store(&bridge.stop, true);
+	pthread_join(bridge.thread, NULL);
+	close(bridge.fd);
+	if (bridge.slave >= 0) close(bridge.slave);
+	bridge.fd = bridge.slave = -1;
+	bridge.name[0] = 0;
+}
+
+
+int openSerial(const char *path) {                                              // "pty" or a Unix socket, 0 on failure
+	closeSerial();
+	int fd = strcmp(path, "pty") ? openSocket(path) : openPty();
+	if (fd < 0) return 0;
+	bridge.fd = fd;
+	atomic_store(&bridge.rx.head, 0);
+	atomic_store(&bridge.rx.tail, 0);
+	atomic_store(&bridge.tx.head, 0);
+	atomic_store(&bridge.tx.tail, 0);
+	atomic_store(&bridge.stop, false);
+	atomic_store(&bridge.open, true);
+	if (pthread_create(&bridge.thread, NULL, bridgeThread, NULL)) {
+		close(fd);
+		if (bridge.slave >= 0) close(bridge.slave);
+		bridge.fd = bridge.slave = -1;
+		return 0;
+	}
+	sscFirmware = romLoaded(sscRom, SSCROMSIZE);
+	plugCard(2, &serialCard);
+	return 1;
+}
+
+
+const char *serialName() {                                                      // the pty to open, or the socket
+	return bridge.name;
+}
+
+
+static bool serialConnected() {
+	return atomic_load(&bridge.open);
+}
+
+
+static bool serialReceive(uint8_t *byte) {
+	return ringGet(&bridge.rx, byte);
+}
+
+
+static bool serialSend(uint8_t byte) {
+	return ringPut(&bridge.tx, byte);
+}
+
+
+static bool serialRoom() {
+	return ringCount(&bridge.tx) < RINGSIZE;
+}
+
+#else                                                                           // no bridge to the host
+
+void closeSerial() {}
+int openSerial(const char *path) { return 0; }
+const char *serialName() { return ""; }
+static bool serialConnected() { return false; }
+static bool serialReceive(uint8_t *byte) { return false; }
+static bool serialSend(uint8_t byte) { return false; }
+static bool serialRoom() { return true; }
+
+#endif
+
+
+static unsigned long long int byteCycles() {                                    // start bit, data bits, parity and stop bits
+	int bits = 1 + 8 - ((acia.control >> 5) & 3) + ((acia.command & 0x20) != 0) + 1 + (acia.control >> 7);
+	return (unsigned long long int)CPUFREQ * bits / baudRates[acia.control & 0x0F];
+}
+
+
+static void resetAcia() {                                                       // the RESET line
+	acia.command = acia.control = 0;
+	acia.status = TDRE;
+}
+
+
+static void serialPoll() {                                                      // between two slices of cpu time
+	if (!(acia.status & RDRF) && ticks >= acia.rxTick && serialReceive(&acia.data)) {
+		acia.status |= RDRF;                                                        // the next one is held by the host end
+		acia.rxTick = (acia.rxTick > ticks ? acia.rxTick : ticks) + byteCycles();   // from the previous deadline, not the check
+		if ((acia.command & 0x03) == 0x01) acia.status |= IRQFLAG;                  // DTR on, receiver interrupts on
+	}
+	if (!(acia.status & TDRE) && ticks + byteCycles() >= acia.txTick && serialRoom()) {
+		acia.status |= TDRE;                                                        // moved to the shift register
+		if ((acia.command & 0x0C) == 0x04) acia.status |= IRQFLAG;                  // transmitter interrupts on
+	}
+	if (acia.status & IRQFLAG) puce6502IRQ();                                     // until the status is read
+}
+
+
+static void execute(unsigned long long int cycles) {                            // puce6502Exec, in slices for the serial card
+	if (slots[2] != &serialCard) {
+		puce6502Exec(cycles);
+		return;
+	}
+	unsigned long long int target = ticks + cycles;
+	while (ticks < target) {
+		puce6502Exec(target - ticks < SERIALSLICE ? target - ticks : SERIALSLICE);
+		serialPoll();
+	}
+}
+
+
+static uint8_t serialSwitches(int slot, uint16_t address, uint8_t value, bool WRT) {
+	switch (address & 0x0F) {
+		case 0x1: return 0xF0;                                                      // SW1 : 19200 baud
+		case 0x2: return 0x02;                                                      // SW2 : 8 bits, 1 stop bit, no parity
+		case 0x8:                                                                   // data
+			if (!WRT) {
+				acia.status &= ~RDRF;
+				return acia.data;
+			}
+			serialSend(value);                                                        // held by the rings
+			acia.status &= ~TDRE;
+			acia.txTick = (acia.txTick > ticks ? acia.txTick : ticks) + byteCycles(); // once the previous one is shifted out
+			return floatingBus();
+		case 0x9:                                                                   // status, written : programmed reset
+			if (WRT) {
+				acia.command &= 0xE0;
+				acia.status &= ~0x04;
+				return floatingBus();
+			} else {
+				uint8_t status = acia.status | (serialConnected() ? 0 : NODCD);
+				acia.status &= ~IRQFLAG;                                                // reading it acknowledges the interrupt
+				return status;
+			}
+		case 0xA:                                                                   // command
+			if (WRT) acia.command = value;
+			return acia.command;
+		case 0xB:                                                                   // control
+			if (WRT) acia.control = value;
+			return acia.control;
+	}
+	return floatingBus();
+}
+
+
+static uint8_t serialRom(int slot, uint16_t address, uint8_t value, bool WRT) {
+	return sscFirmware ? sscRom[0x700 + (address & 0xFF)] : floatingBus();        // $C200 is its last page
+}
+
+
+static uint8_t serialExpansion(int slot, uint16_t address, uint8_t value, bool WRT) {
+	return sscFirmware ? sscRom[address & 0x7FF] : floatingBus();
+}
+
+
+const struct card serialCard = { serialSwitches, serialRom, serialExpansion };
+
+
+//========================================== MEMORY MAPPED SOFT SWITCHES HANDLER
+// one handler per address of page $C0, decoded as the motherboard does : by
+// groups of 16 addresses, $C080-$C0FF being the device selects of the slots.
+// readMem and writeMem reach any of them with a single indirect call
+
+static uint8_t keyboard(uint16_t address, uint8_t value, bool WRT) {            // $C00x KEYBOARD
+	typeAhead.unread = false;
+	return KBD;
+}
+
+
+static uint8_t strobe(uint16_t address, uint8_t value, bool WRT) {              // $C01x KBDSTROBE
+	return clearStrobe();
+}
+
+
+static uint8_t tapeOut(uint16_t address, uint8_t value, bool WRT) {             // $C02x TAPEOUT
+	writeTape();
+	return floatingBus();
+}
+
+
+static uint8_t speaker(uint16_t address, uint8_t value, bool WRT) {             // $C03x SPEAKER
+	playSound();
+	return floatingBus();
+}
+
+
+static uint8_t textOff(uint16_t address, uint8_t value, bool WRT) {             // $C050 Graphics
+	TEXT = false;
+	return floatingBus();
+}
+
+
+static uint8_t textOn(uint16_t address, uint8_t value, bool WRT) {              // $C051 Text
+	TEXT = true;
+	return floatingBus();
+}
+
+
+static uint8_t mixedOff(uint16_t address, uint8_t value, bool WRT) {            // $C052 Mixed off
+	MIXED = false;
+	return floatingBus();
+}
+
+
+static uint8_t mixedOn(uint16_t address, uint8_t value, bool WRT) {             // $C053 Mixed on
+	MIXED = true;
+	return floatingBus();
+}
+
+
+static uint8_t page2Off(uint16_t address, uint8_t value, bool WRT) {            // $C054 PAGE2 off
+	PAGE2 = false;
+	if (STORE80) mapMemory();                                                     // they select the //e display memory
+	return floatingBus();
+}
+
+
+static uint8_t page2On(uint16_t address, uint8_t value, bool WRT) {             // $C055 PAGE2 on
+	PAGE2 = true;
+	if (STORE80) mapMemory();                                                     // they select the //e display memory
+	return floatingBus();
+}
+
+
+static uint8_t hiresOff(uint16_t address, uint8_t value, bool WRT) {            // $C056 HiRes off
+	HIRES = false;
+	if (STORE80) mapMemory();                                                     // they select the //e display memory
+	return floatingBus();
+}
+
+
+static uint8_t hiresOn(uint16_t address, uint8_t value, bool WRT) {             // $C057 HiRes on
+	HIRES = true;
+	if (STORE80) mapMemory();                                                     // they select the //e display memory
+	return floatingBus();
+}
+
+
+static uint8_t tapeIn(uint16_t address, uint8_t value, bool WRT) {              // $C060 TAPEIN
+	return readTape();
+}
+
+
+static uint8_t button0(uint16_t address, uint8_t value, bool WRT) {             // $C061 Push Button 0
+	return PB0;
+}
+
+
+static uint8_t button1(uint16_t address, uint8_t value, bool WRT) {             // $C062 Push Button 1
+	return PB1;
+}
+
+
+static uint8_t button2(uint16_t address, uint8_t value, bool WRT) {             // $C063 Push Button 2
+	return PB2;
+}
+
+
+static uint8_t paddle0(uint16_t address, uint8_t value, bool WRT) {             // $C064 Paddle 0
+	return readPaddle(0);
+}
+
+
+static uint8_t paddle1(uint16_t address, uint8_t value, bool WRT) {             // $C065 Paddle 1
+	return readPaddle(1);
+}
+
+
+static uint8_t paddleTimer(uint16_t address, uint8_t value, bool WRT) {         // $C07x paddle timer RST
+	resetPaddles();
+	return floatingBus();
+}
+
+
+static uint8_t floating(uint16_t address, uint8_t value, bool WRT) {            // nothing there
+	return floatingBus();
+}
+
+
+static uint8_t keyboardIIe(uint16_t address, uint8_t value, bool WRT) {         // $C00x KEYBOARD, written : the //e switches
+	if (!WRT) {
+		typeAhead.unread = false;
+		return KBD;
+	}
+	bool on = address & 1;
+	switch (address & 0x0E) {
+		case 0x0: STORE80 = on;   break;
+		case 0x2: RAMRD = on;     break;
+		case 0x4: RAMWRT = on;    break;
+		case 0x6: INTCXROM = on;  break;
+		case 0x8: ALTZP = on;     break;
+		case 0xA: SLOTC3ROM = on; break;
+		case 0xC: COL80 = on;     break;
+		case 0xE: ALTCHAR = on;   break;
+	}
+	if ((address & 0x0E) <= 0x08) mapMemory();
+	return floatingBus();
+}
+
+
+static uint8_t statusIIe(uint16_t address, uint8_t value, bool WRT) {           // $C01x KBDSTROBE, read : a switch in bit 7
+	if (WRT || address == 0xC010) return clearStrobe();
+	bool flag = false;
+	switch (address & 0x0F) {
+		case 0x1: flag = LCBK2;     break;
+		case 0x2: flag = LCRD;      break;
+		case 0x3: flag = RAMRD;     break;
+		case 0x4: flag = RAMWRT;    break;
+		case 0x5: flag = INTCXROM;  break;
+		case 0x6: flag = ALTZP;     break;
+		case 0x7: flag = SLOTC3ROM; break;
+		case 0x8: flag = STORE80;   break;
+		case 0x9: flag = ticks % FRAMECYCLES < 192 * 65; break;                     // RDVBLBAR, low during the blanking
+		case 0xA: flag = TEXT;      break;
+		case 0xB: flag = MIXED;     break;
+		case 0xC: flag = PAGE2;     break;
+		case 0xD: flag = HIRES;     break;
+		case 0xE: flag = ALTCHAR;   break;
+		case 0xF: flag = COL80;     break;
+	}
+	return flag << 7 | (KBD & 0x7F);
+}
+
+
+static uint8_t an0Off(uint16_t address, uint8_t value, bool WRT) {              // $C058 annunciator 0 off
+	AN0 = false;
+	return floatingBus();
+}
+
+
+static uint8_t an0On(uint16_t address, uint8_t value, bool WRT) {               // $C059 annunciator 0 on
+	AN0 = true;
+	return floatingBus();
+}
+
+
+static uint8_t dhiresOn(uint16_t address, uint8_t value, bool WRT) {            // $C05E annunciator 3 off
+	DHIRES = true;
+	return floatingBus();
+}
+
+
+static uint8_t dhiresOff(uint16_t address, uint8_t value, bool WRT) {           // $C05F annunciator 3 on
+	DHIRES = false;
+	return floatingBus();
+}
+
+#define X16(h) h, h, h, h, h, h, h, h, h, h, h, h, h, h, h, h
+
+static uint8_t (*const switchesPlus[256])(uint16_t address, uint8_t value, bool WRT) = {
+	X16(keyboard), X16(strobe), X16(tapeOut), X16(speaker), X16(floating),        // $C000-$C04F
+	textOff, textOn, mixedOff, mixedOn, page2Off, page2On, hiresOff, hiresOn,     // $C050-$C057
+	an0Off, an0On, floating, floating,                                            // $C058-$C05B annunciators
+	floating, floating, floating, floating,                                       // $C05C-$C05F
+	tapeIn, button0, button1, button2, paddle0, paddle1, floating, floating,      // $C060-$C067
+	tapeIn, button0, button1, button2, paddle0, paddle1, floating, floating,      // $C068-$C06F
+	X16(paddleTimer),                                                             // $C070-$C07F
+	X16(deviceSelect), X16(deviceSelect), X16(deviceSelect), X16(deviceSelect),   // slots 0 to 3
+	X16(deviceSelect), X16(deviceSelect), X16(deviceSelect), X16(deviceSelect)    // slots 4 to 7
+};
+
+
+static uint8_t (*const switchesIIe[256])(uint16_t address, uint8_t value, bool WRT) = {
+	X16(keyboardIIe), X16(statusIIe), X16(tapeOut), X16(speaker), X16(floating),  // $C000-$C04F
+	textOff, textOn, mixedOff, mixedOn, page2Off, page2On, hiresOff, hiresOn,     // $C050-$C057
+	floating, floating, floating, floating,                                       // $C058-$C05B annunciators
+	floating, floating, dhiresOn, dhiresOff,                                      // $C05C-$C05F
+	tapeIn, button0, button1, button2, paddle0, paddle1, floating, floating,      // $C060-$C067
+	tapeIn, button0, button1, button2, paddle0, paddle1, floating, floating,      // $C068-$C06F
+	X16(paddleTimer),                                                             // $C070-$C07F
+	X16(deviceSelect), X16(deviceSelect), X16(deviceSelect), X16(deviceSelect),   // slots 0 to 3
+	X16(deviceSelect), X16(deviceSelect), X16(deviceSelect), X16(deviceSelect)    // slots 4 to 7
+};
+
+
+static THREADLOCAL uint8_t (*const *switches)(uint16_t address, uint8_t value, bool WRT) = switchesPlus;
+
+
+uint8_t softSwitches(uint16_t address, uint8_t value, bool WRT) {               // $C000-$C0FF
+	return switches[address & 0xFF](address, value, WRT);
+}
+
+
+int setApple2e(bool on) {                                                       // 0 if the //e rom was not loaded
+	if (on && !(romIIe[0x3FFC] | romIIe[0x3FFD])) return 0;                       // no reset vector
+	apple2e = on;
+	switches = on ? switchesIIe : switchesPlus;
+	resetSwitches();
+	return 1;
+}
+
+
+void pressReset() {                                                             // the RESET key
+	if (apple2e) resetSwitches();
+	resetAcia();
+	puce6502RST();
+}
+
+
+static uint8_t (*const ioPages[16])(uint16_t address, uint8_t value, bool WRT) = {
+	softSwitches, ioSelect, ioSelect, ioSelect, ioSelect, ioSelect, ioSelect, ioSelect,
+	expansionRom, expansionRom, expansionRom, expansionRom, expansionRom, expansionRom, expansionRom, expansionRom
+};
+
+
+//======================================================================= MEMORY
+// these two functions are imported into puce6502.c
+
+uint8_t readMem(uint16_t address) {
+	if (address < RAMSIZE) {
+		if ((address & 0x7FFF) == 0x3D00 && hleDisk && getPC() == address + 1)
+			return rwtsTrap(address);                                                 // opcode fetch of RWTS ($BD00 or $3D00)
+		return readPages[address >> 8][address & 0xFF];                             // RAM, main or aux
+	}
+
+	if (address >= ROMSTART) {
+		if (address == 0xFEFD && !LCRD && !apple2e && tape.fastLoad && tape.blockIdx < tape.blockCount && getPC() == 0xFEFE)
+			return fastReadTape();                                                    // opcode fetch of Monitor READ
+		return readPages[address >> 8][address & 0xFF];                             // ROM or Language Card
+	}
+
+	if (address < 0xC100)
+		return switches[address & 0xFF](address, 0, false);                         // Soft Switches
+
+	return ioPages[(address >> 8) & 0xF](address, 0, false);                      // slots
+}
+
+
+void writeMem(uint16_t address, uint8_t value) {
+	if (address < RAMSIZE) {
+		writePages[address >> 8][address & 0xFF] = value;                           // RAM, main or aux
+		return;
+	}
+
+	if (address >= ROMSTART) {
+		if (writePages[address >> 8])
+			writePages[address >> 8][address & 0xFF] = value;                         // Language Card
+		return;
+	}
+
+	if (address < 0xC100)
+		switches[address & 0xFF](address, value, true);                             // Soft Switches
+	else
+		ioPages[(address >> 8) & 0xF](address, value, true);                        // slots
+}
+
+
+uint8_t peek(uint16_t address) {                                                // as the cpu sees it, but the I/O page
+	return (address & 0xFF00) == 0xC000 ? 0 : readMem(address);                   // (reading a soft switch flips it)
+}
+
+
+//================================================================= SAVE STATES
+// the whole machine, as a header followed by chunks {id, length, data} read
+// in any order, unknown ones are skipped. The disks are stored as the tracks
+// and blocks written to since they were inserted, the others are taken back
+// from the images as loaded. A state is checked whole before any chunk is
+// restored, and restoring never writes to the image files
+
+#define STATEVERSION 1
+#define IOLENGTH (13 + 2 * (2 * sizeof(float) + 8) + 16)                        // the IO chunk, expansion slot and AN0 aside
+#define DRIVELENGTH 50                                                          // the DRIV chunk, drive and filename aside
+
+static void putBytes(struct snapshot *s, const void *bytes, long length) {
+	if (s->size + length > s->capacity) {                                         // grows by half at least
+		long capacity = s->capacity + s->capacity / 2 > s->size + length ? s->capacity + s->capacity / 2 : s->size + length;
+		uint8_t *data = realloc(s->data, capacity);
+		if (!data) {
+			s->error = true;
+			return;
+		}
+		s->data = data;
+		s->capacity = capacity;
+	}
+	memcpy(s->data + s->size, bytes, length);
+	s->size += length;
+}
+
+
+static void putInt(struct snapshot *s, unsigned long long int value, int bytes) { // little endian
+	uint8_t b[8];
+	for (int i = 0; i < bytes; i++) b[i] = value >> (i * 8);
+	putBytes(s, b, bytes);
+}
+
+
+static void putString(struct snapshot *s, const char *string) {
+	putInt(s, strlen(string), 2);
+	putBytes(s, string, strlen(string));
+}
+
+
+static long beginChunk(struct snapshot *s, const char *id) {                    // the length is known at the end
+	putBytes(s, id, 4);
+	putInt(s, 0, 4);
+	return s->size;
+}
+
+
+static void endChunk(struct snapshot *s, long start) {
+	if (s->error) return;
+	for (int i = 0; i < 4; i++) s->data[start - 4 + i] = (s->size - start) >> (i * 8);
+}
+
+
+static const uint8_t *getBytes(struct snapshot *s, long length) {               // NULL once past the end
+	if (s->error || length > s->size - s->pos) {
+		s->error = true;
+		return NULL;
+	}
+	s->pos += length;
+	return s->data + s->pos - length;
+}
+
+
+static unsigned long long int getInt(struct snapshot *s, int bytes) {
+	const uint8_t *b = getBytes(s, bytes);
+	unsigned long long int value = 0;
+	for (int i = 0; b && i < bytes; i++) value |= (unsigned long long int)b[i] << (i * 8);
+	return value;
+}
+
+
+static void getString(struct snapshot *s, char *string, int size) {             // truncated to size
+	int length = getInt(s, 2);
+	const uint8_t *b = getBytes(s, length);
+	if (length >= size) length = size - 1;
+	memcpy(string, b ? (const char *)b : "", b ? length : 0);
+	string[b ? length : 0] = 0;
+}
+
+
+static uint8_t *trackData(int drv, int t, long *length) {                       // the bits or nibbles of a track, NULL if none
+	struct drive *d = &disk[drv];
+	if (!d->image) return NULL;
+	if (d->format == WOZ) {
+		long offset;
+		trackExtent(drv, t, &offset, length);
+		return *length ? d->image + offset : NULL;
+	}
+	*length = TRKSIZE;
+	return t < TRACKS ? d->tracks[t] : NULL;                                      // DO and PO : only once nibblelized
+}
+
+
+int saveState(struct snapshot *s, bool full) {                                  // full : every track and block, for the movies
+	s->size = 0;
+	s->error = false;
+	putBytes(s, "REINETTE", 8);
+	putInt(s, STATEVERSION, 4);
+
+	puce6502Regs regs;
+	puce6502GetRegs(&regs);
+	long chunk = beginChunk(s, "CPU ");
+	putInt(s, regs.PC, 2);
+	putInt(s, regs.A, 1);
+	putInt(s, regs.X, 1);
+	putInt(s, regs.Y, 1);
+	putInt(s, regs.SP, 1);
+	putInt(s, regs.P, 1);
+	putInt(s, ticks, 8);
+	endChunk(s, chunk);
+
+	chunk = beginChunk(s, "MEM ");
+	putBytes(s, ram, RAMSIZE);
+	putBytes(s, lgc, LGCSIZE);
+	putBytes(s, bk2, BK2SIZE);
+	endChunk(s, chunk);
+
+	chunk = beginChunk(s, "IO  ");                                                // soft switches, paddles and speaker
+	uint8_t flags[] = { KBD, TEXT, MIXED, PAGE2, HIRES, LCWR, LCRD, LCBK2, LCWFF, PB0, PB1, PB2, SPKR };
+	putBytes(s, flags, sizeof(flags));
+	for (int i = 0; i < 2; i++) {
+		putBytes(s, &GCP[i], sizeof(float));                                        // host floats
+		putBytes(s, &GCC[i], sizeof(float));
+		putInt(s, GCD[i], 4);
+		putInt(s, GCA[i], 4);
+	}
+	putInt(s, GCCrigger, 8);
+	putInt(s, speakerTick, 8);
+	putInt(s, expansionSlot, 1);
+	putInt(s, AN0, 1);
+	endChunk(s, chunk);
+
+	chunk = beginChunk(s, "KEYS");                                                // the keys typed ahead
+	putInt(s, typeAhead.unread, 1);
+	putInt(s, typeAhead.count - typeAhead.pos, 4);
+	putBytes(s, typeAhead.keys + typeAhead.pos, typeAhead.count - typeAhead.pos);
+	endChunk(s, chunk);
+
+	chunk = beginChunk(s, "TAPE");
+	putString(s, tape.filename);
+	putInt(s, tape.playing, 1);
+	putInt(s, tape.start, 8);
+	putInt(s, tape.edgeIdx, 4);
+	putInt(s, tape.blockIdx, 4);
+	putInt(s, tape.byteIdx, 4);
+	endChunk(s, chunk);
+
+	if (apple2e) {
+		chunk = beginChunk(s, "IIE ");                                              // the //e switches and aux memory
+		uint8_t flags[] = { STORE80, RAMRD, RAMWRT, INTCXROM, ALTZP, SLOTC3ROM, COL80, ALTCHAR, DHIRES, INTC8ROM };
+		putBytes(s, flags, sizeof(flags));
+		putBytes(s, aux, AUXSIZE);
+		endChunk(s, chunk);
+	}
+
+	if (slots[3] == &videxCard) {
+		chunk = beginChunk(s, "VIDX");                                              // the CRTC and the screen ram
+		putInt(s, videx.reg, 1);
+		putInt(s, videx.bank, 1);
+		putBytes(s, videx.crtc, sizeof(videx.crtc));
+		putBytes(s, videx.ram, VIDEXRAMSIZE);
+		endChunk(s, chunk);
+	}
+
+	if (slots[2] == &serialCard) {
+		chunk = beginChunk(s, "SSC ");                                              // the ACIA, not the bytes in the rings
+		uint8_t registers[] = { acia.data, acia.status, acia.command, acia.control };
+		putBytes(s, registers, sizeof(registers));
+		putInt(s, acia.rxTick, 8);
+		putInt(s, acia.txTick, 8);
+		endChunk(s, chunk);
+	}
+
+	chunk = beginChunk(s, "SATN");                                                // the language card banks but its own
+	putInt(s, saturn.banks, 1);
+	putInt(s, saturn.bank, 1);
+	if (saturn.extra) putBytes(s, saturn.extra, (saturn.banks - 1) * SATURNBANK);
+	endChunk(s, chunk);
+
+	chunk = beginChunk(s, "HDD ");                                                // {block, dirty, bytes} of the blocks written to
+	putString(s, hdd.filename);
+	putInt(s, full, 1);                                                           // complete : not taken from the image file
+	static const uint8_t zeros[512] = { 0 };
+	for (long b = 0; hdd.image && b < hdd.blocks; b++) {
+		if (full ? !memcmp(hdd.image + b * 512, zeros, 512) : !hdd.written[b]) continue;
+		putInt(s, b, 2);
+		putInt(s, hdd.dirty[b], 1);
+		putBytes(s, hdd.image + b * 512, 512);
+	}
+	endChunk(s, chunk);
+
+	for (int ctl = 0; ctl < CONTROLLERS; ctl++) {
+		chunk = beginChunk(s, "SLOT");
+		putInt(s, ctl, 1);
+		putInt(s, diskII[ctl].enabled, 1);
+		putInt(s, diskII[ctl].curDrv, 1);
+		for (int i = 0; i < 8; i++) putInt(s, diskII[ctl].phases[i / 4][i % 4], 1);
+		putInt(s, diskII[ctl].dLatch, 1);
+		endChunk(s, chunk);
+	}
+
+	for (int drv = 0; drv < DRIVES; drv++) {
+		struct drive *d = &disk[drv];
+		chunk = beginChunk(s, "DRIV");
+		putInt(s, drv, 1);
+		putString(s, d->filename);
+		uint8_t flags[] = { d->motorOn, d->flush, d->writeMode, d->halfTrack, d->track, d->latch, d->held, d->heldBit };
+		putBytes(s, flags, sizeof(flags));
+		putInt(s, d->motorStop, 8);
+		putInt(s, d->nibble, 2);
+		putInt(s, d->nibbleTick, 8);
+		putInt(s, d->trk, 4);
+		putInt(s, d->bitPos, 4);
+		putInt(s, d->bitTick, 8);
+		putInt(s, d->bitFrac, 4);
+		putInt(s, d->writtenBits, 4);
+		for (int t = 0; t < WOZTRKS; t++) {                                         // {track, dirty + 2 * written, length, bytes}
+			if (full && (d->format == DO || d->format == PO) && t < TRACKS && d->image && !d->tracks[t])
+				nibblizeTrack(drv, t);                                                  // no need to guess them back
+			long length;
+			uint8_t *data = trackData(drv, t, &length);
+			if (!data || (!full && !d->written[t])) continue;
+			putInt(s, t, 1);
+			putInt(s, d->dirty[t] | d->written[t] << 1, 1);
+			putInt(s, length, 4);
+			putBytes(s, data, length);
+		}
+		endChunk(s, chunk);
+	}
+	return !s->error;
+}
+
+
+static void revertTrack(int drv, int t) {                                       // back to the image as inserted
+	struct drive *d = &disk[drv];
+	if (d->shared && d->image != d->shared->image) {                              // (no copy of it otherwise)
+		long offset, length;
+		trackExtent(drv, t, &offset, &length);
+		memcpy(d->image + offset, d->shared->image + offset, length);
+		if ((d->format == DO || d->format == PO) && t < TRACKS) {                   // and its nibbles
+			free(d->tracks[t]);
+			nibblizeTrack(drv, t);
+		}
+	}
+	d->written[t] = false;
+	d->dirty[t] = true;                                                           // the file may have had another content
+	d->flush = true;
+}
+
+
+static void loadDrive(struct snapshot *s, long end) {
+	int drv = getInt(s, 1);
+	char filename[400];
+	getString(s, filename, sizeof(filename));
+	if (s->error || drv >= DRIVES) return;
+
+	struct drive *d = &disk[drv];
+	if (strcmp(filename, d->filename) && (!filename[0] || !loadFloppy(filename, drv)))
+		ejectFloppy(drv);                                                           // another floppy, or none
+
+	const uint8_t *flags = getBytes(s, 8);
+	if (!flags) return;
+	d->motorOn = flags[0];
+	d->flush = flags[1];
+	d->writeMode = flags[2] && d->image && ownImage(drv);                         // (the writes go to its own copy)
+	d->halfTrack = flags[3] < 69 ? flags[3] : 68;
+	d->track = (d->halfTrack + 1) / 2;
+	d->latch = flags[5];
+	d->held = flags[6];
+	d->heldBit = flags[7];
+	d->motorStop = getInt(s, 8);
+	d->nibble = getInt(s, 2) % TRKSIZE;
+	d->nibbleTick = getInt(s, 8);
+	d->trk = getInt(s, 4);
+	d->bitPos = getInt(s, 4);
+	d->bitTick = getInt(s, 8);
+	d->bitFrac = getInt(s, 4);
+	d->writtenBits = getInt(s, 4);
+
+	bool restored[WOZTRKS] = { false };
+	while (!s->error && s->pos < end) {                                           // the tracks
+		int t = getInt(s, 1);
+		int state = getInt(s, 1);                                                   // dirty + 2 * written, or dirty alone
+		long length = getInt(s, 4), current;
+		const uint8_t *data = getBytes(s, length);
+		if (!data || t >= WOZTRKS || !d->image) continue;
+		if ((d->format == DO || d->format == PO) && t < TRACKS && !d->tracks[t])
+			nibblizeTrack(drv, t);
+		uint8_t *track = trackData(drv, t, &current);
+		if (!track || current != length) continue;                                  // not the same image
+		bool differs = memcmp(track, data, length) != 0;
+		if (differs) {                                                              // back to the saved content
+			if (!ownImage(drv)) continue;
+			track = trackData(drv, t, &current);
+			memcpy(track, data, length);
+			d->flush = true;                                                          // and the file will follow
+		}
+		if (differs || (state & 1)) d->dirty[t] = true;
+		d->written[t] = differs || state;
+		restored[t] = true;
+	}
+	for (int t = 0; t < WOZTRKS; t++)                                             // written to since the state was saved
+		if (d->written[t] && !restored[t]) revertTrack(drv, t);
+}
+
+
+static void restoreBlock(long b, const uint8_t *data) {
+	uint8_t *block = hdd.image + b * 512;
+	if (memcmp(block, data, 512)) {
+		keepBase();
+		memcpy(block, data, 512);
+		hdd.dirty[b] = true;                                                        // the file will follow
+	}
+	hdd.written[b] = hdd.base && memcmp(block, hdd.base + b * 512, 512);          // differs from the image as loaded
+}
+
+
+static void loadBlocks(struct snapshot *s, long end) {                          // the hard disk, as loadDrive does
+	char filename[400];
+	getString(s, filename, sizeof(filename));
+	bool complete = s->pos < end && getInt(s, 1);                                 // the blocks not stored are zeros
+	if (s->error) return;
+	if (strcmp(filename, hdd.filename) && (!filename[0] || !loadHardDisk(filename)))
+		dropHardDisk();                                                             // another hard disk, or none
+	if (!hdd.image) return;
+
+	bool *restored = calloc(hdd.blocks, sizeof(bool));
+	if (!restored) return;
+	while (!s->error && s->pos < end) {                                           // {block, dirty, bytes}
+		long b = getInt(s, 2);
+		bool dirty = getInt(s, 1) != 0;
+		const uint8_t *data = getBytes(s, 512);
+		if (!data || b >= hdd.blocks) continue;
+		restoreBlock(b, data);
+		if (dirty) hdd.dirty[b] = true;
+		restored[b] = true;
+	}
+	static const uint8_t zeros[512] = { 0 };
+	for (long b = 0; b < hdd.blocks; b++)                                         // written to since the state was saved
+		if (!restored[b] && (complete || hdd.written[b]))
+			restoreBlock(b, complete ? zeros : hdd.base ? hdd.base + b * 512 : hdd.image + b * 512);
+	free(restored);
+}
+
+
+static int checkState(struct snapshot *s) {                                     // 0 if a chunk can't be restored
+	s->pos = 0;
+	s->error = false;
+	const uint8_t *header = getBytes(s, 8);
+	if (!header || memcmp(header, "REINETTE", 8) || getInt(s, 4) != STATEVERSION)
+		return 0;
+
+	while (s->pos < s->size) {
+		const uint8_t *id = getBytes(s, 4);
+		long length = getInt(s, 4);
+		if (s->error || length > s->size - s->pos) return 0;
+		struct snapshot chunk = { .data = s->data + s->pos, .size = length };       // can't be read past its end
+
+		if (!memcmp(id, "CPU ", 4)) {
+			getBytes(&chunk, 15);
+		} else if (!memcmp(id, "TAPE", 4)) {
+			getBytes(&chunk, getInt(&chunk, 2));                                      // filename
+			getBytes(&chunk, 21);
+		} else if (!memcmp(id, "IIE ", 4) && length == 10 + AUXSIZE) {
+			if (!(romIIe[0x3FFC] | romIIe[0x3FFD])) return 0;                         // no //e rom here
+		} else if (!memcmp(id, "VIDX", 4) && length == 2 + sizeof(videx.crtc) + VIDEXRAMSIZE) {
+			if (slots[3] != &videxCard && !(romLoaded(videxRom, VIDEXROMSIZE) && romLoaded(videxFont, VIDEXFONTSIZE)))
+				return 0;                                                               // no Videx roms here
+		} else if (!memcmp(id, "HDD ", 4)) {
+			getBytes(&chunk, getInt(&chunk, 2));
+			if (chunk.pos < chunk.size) getInt(&chunk, 1);
+			while (!chunk.error && chunk.pos < chunk.size) getBytes(&chunk, 2 + 1 + 512);
+		} else if (!memcmp(id, "DRIV", 4)) {
+			getInt(&chunk, 1);
+			getBytes(&chunk, getInt(&chunk, 2));
+			getBytes(&chunk, DRIVELENGTH);
+			while (!chunk.error && chunk.pos < chunk.size) {                          // {track, dirty, length, bytes}
+				getInt(&chunk, 2);
+				getBytes(&chunk, getInt(&chunk, 4));
+			}
+		}
+		if (chunk.error) return 0;
+		s->pos += length;
+	}
+	return 1;
+}
+
+
+int loadState(struct snapshot *s) {                                             // 0 if not a valid state, left untouched
+	if (!checkState(s)) return 0;
+	s->pos = 12;                                                                  // after the header
+
+	typeAhead.pos = typeAhead.count = 0;                                          // unless the state has some
+	typeAhead.unread = false;
+	saturn.bank = 0;                                                              // unless the state selects one
+	bool iie = false;                                                             // a II plus, unless the state is a //e one
+	bool videoterm = false;                                                       // and no Videx card, unless it has one
+	bool serial = false;                                                          // nor a serial card
+	while (s->pos < s->size) {                                                    // the chunks were checked
+		const uint8_t *id = getBytes(s, 4);
+		long length = getInt(s, 4);
+		long end = s->pos + length;
+
+		if (!memcmp(id, "CPU ", 4)) {
+			puce6502Regs regs;
+			regs.PC = getInt(s, 2);
+			regs.A = getInt(s, 1);
+			regs.X = getInt(s, 1);
+			regs.Y = getInt(s, 1);
+			regs.SP = getInt(s, 1);
+			regs.P = getInt(s, 1);
+			ticks = getInt(s, 8);
+			puce6502SetRegs(&regs);
+		} else if (!memcmp(id, "MEM ", 4) && length == RAMSIZE + LGCSIZE + BK2SIZE) {
+			memcpy(ram, getBytes(s, RAMSIZE), RAMSIZE);
+			memcpy(lgc, getBytes(s, LGCSIZE), LGCSIZE);
+			memcpy(bk2, getBytes(s, BK2SIZE), BK2SIZE);
+		} else if (!memcmp(id, "IO  ", 4) && length >= IOLENGTH) {
+			const uint8_t *flags = getBytes(s, 13);
+			KBD = flags[0];
+			TEXT = flags[1] != 0;
+			MIXED = flags[2] != 0;
+			PAGE2 = flags[3] != 0;
+			HIRES = flags[4] != 0;
+			LCWR = flags[5] != 0;
+			LCRD = flags[6] != 0;
+			LCBK2 = flags[7] != 0;
+			LCWFF = flags[8] != 0;
+			PB0 = flags[9];
+			PB1 = flags[10];
+			PB2 = flags[11];
+			SPKR = flags[12] != 0;
+			for (int i = 0; i < 2; i++) {
+				const uint8_t *f = getBytes(s, sizeof(float));
+				if (f) memcpy(&GCP[i], f, sizeof(float));
+				f = getBytes(s, sizeof(float));
+				if (f) memcpy(&GCC[i], f, sizeof(float));
+				GCD[i] = (int)getInt(s, 4);
+				GCA[i] = (int)getInt(s, 4);
+			}
+			GCCrigger = getInt(s, 8);
+			speakerTick = getInt(s, 8);
+			expansionSlot = s->pos < end ? getInt(s, 1) % 8 : 0;
+			AN0 = s->pos < end && getInt(s, 1);
+		} else if (!memcmp(id, "KEYS", 4) && length >= 5) {
+			bool unread = getInt(s, 1) != 0;
+			long count = getInt(s, 4);
+			const uint8_t *keys = count <= length - 5 ? getBytes(s, count) : NULL;
+			if (keys && reserveKeys(count)) {                                         // into the emptied queue
+				memcpy(typeAhead.keys, keys, count);
+				typeAhead.count = count;
+			}
+			typeAhead.unread = unread;
+		} else if (!memcmp(id, "TAPE", 4)) {
+			char filename[400];
+			getString(s, filename, sizeof(filename));
+			if (filename[0] && strcmp(filename, tape.filename)) insertTape(filename);
+			tape.playing = getInt(s, 1) != 0;
+			tape.start = getInt(s, 8);
+			int edgeIdx = getInt(s, 4), blockIdx = getInt(s, 4), byteIdx = getInt(s, 4);
+			if (!strcmp(filename, tape.filename)) {                                   // the same tape is in the deck
+				tape.edgeIdx = edgeIdx <= tape.edgeCount ? edgeIdx : tape.edgeCount;
+				tape.blockIdx = blockIdx <= tape.blockCount ? blockIdx : tape.blockCount;
+				tape.byteIdx = byteIdx;
+			}
+		} else if (!memcmp(id, "IIE ", 4) && length == 10 + AUXSIZE) {
+			const uint8_t *flags = getBytes(s, 10);
+			apple2e = iie = true;                                                     // the LC switches are already restored
+			switches = switchesIIe;
+			bool *switches[] = { &STORE80, &RAMRD, &RAMWRT, &INTCXROM, &ALTZP, &SLOTC3ROM, &COL80, &ALTCHAR, &DHIRES, &INTC8ROM };
+			for (int i = 0; i < 10; i++) *switches[i] = flags[i] != 0;
+			memcpy(aux, getBytes(s, AUXSIZE), AUXSIZE);
+		} else if (!memcmp(id, "VIDX", 4) && length == 2 + sizeof(videx.crtc) + VIDEXRAMSIZE) {
+			if (slots[3] != &videxCard) setVidex(true);                               // its roms were checked
+			videoterm = true;
+			videx.reg = getInt(s, 1) & 0x1F;
+			videx.bank = getInt(s, 1) & 3;
+			memcpy(videx.crtc, getBytes(s, sizeof(videx.crtc)), sizeof(videx.crtc));
+			memcpy(videx.ram, getBytes(s, VIDEXRAMSIZE), VIDEXRAMSIZE);
+		} else if (!memcmp(id, "SSC ", 4) && length == 20) {
+			const uint8_t *registers = getBytes(s, 4);
+			serial = true;
+			plugCard(2, &serialCard);                                                 // connected to the host or not
+			acia.data = registers[0];
+			acia.status = registers[1] & (IRQFLAG | TDRE | RDRF | 0x07);
+			acia.command = registers[2];
+			acia.control = registers[3];
+			acia.rxTick = getInt(s, 8);
+			acia.txTick = getInt(s, 8);
+		} else if (!memcmp(id, "SATN", 4) && length >= 2) {
+			int banks = getInt(s, 1), bank = getInt(s, 1);
+			if (length == 2 + (banks - 1) * SATURNBANK && (banks == saturn.banks || setLanguageCard(banks * 16))) {
+				if (saturn.extra) memcpy(saturn.extra, getBytes(s, length - 2), length - 2);
+				saturn.bank = bank & (banks - 1);
+			}
+		} else if (!memcmp(id, "HDD ", 4)) {
+			loadBlocks(s, end);
+		} else if (!memcmp(id, "SLOT", 4) && length == 12) {
+			int ctl = getInt(s, 1) % CONTROLLERS;
+			diskII[ctl].enabled = getInt(s, 1) != 0;
+			plugCard(ctl ? 5 : 6, diskII[ctl].enabled ? &diskIICard : NULL);
+			diskII[ctl].curDrv = ctl * 2 + getInt(s, 1) % 2;
+			for (int i = 0; i < 8; i++) diskII[ctl].phases[i / 4][i % 4] = getInt(s, 1) != 0;
+			diskII[ctl].dLatch = getInt(s, 1);
+		} else if (!memcmp(id, "DRIV", 4)) {
+			loadDrive(s, end);
+		}
+		s->pos = end;                                                               // what is left is skipped
+	}
+	if (!iie && apple2e) {                                                        // keeping the II plus switches
+		apple2e = false;
+		switches = switchesPlus;
+	}
+	if (!videoterm && slots[3] == &videxCard) setVidex(false);
+	if (!serial && slots[2] == &serialCard) plugCard(2, NULL);
+	videx.dirty = VIDEXALLROWS;                                                   // its screen is redrawn
+	mapMemory();                                                                  // from the switches restored
+	return 1;
+}
+
+
+int saveStateFile(char *filename) {
+	struct snapshot s = { 0 };
+	bool success = saveState(&s, false);
+	FILE *f = success ? fopen(filename, "wb") : NULL;
+	if (!f || fwrite(s.data, 1, s.size, f) != s.size) success = false;
+	if (f && fclose(f)) success = false;
+	free(s.data);
+	return success;
+}
+
+
+int loadStateFile(char *filename) {
+	FILE *f = fopen(filename, "rb");
+	if (!f) return 0;
+	fseek(f, 0, SEEK_END);
+	struct snapshot s = { .size = ftell(f) };
+	rewind(f);
+	s.data = malloc(s.size > 0 ? s.size : 1);
+	bool success = s.data && fread(s.data, 1, s.size, f) == s.size && loadState(&s);
+	fclose(f);
+	free(s.data);
+	return success;
+}
+
+
+//====================================================================== REWIND
+// a snapshot is taken every few frames, the previous one is kept in a ring
+// buffer as its difference to this one : XOR, then runs of zero and literal
+// 8 bytes words. Going back decodes the newest difference against the last
+// snapshot, the oldest ones are dropped when the budget is reached. Only the
+// tracks and blocks written to are in the snapshots, the images in memory
+// give the others back : going back never writes the image files, and only
+// reads the ones of the media swapped meanwhile
+
+#define REWINDMAX    4096                                                       // snapshots in the ring
+
+THREADLOCAL struct history {
+	uint8_t  *ring;                                                               // allocated once, NULL if disabled
+	long     budget;                                                              // its size in bytes
+	int      frames;                                                              // between two snapshots
+	int      countdown;                                                           // frames until the next one
+	struct {
+		long   offset, length;                                                      // the encoded difference in the ring
+		long   size;                                                                // the size of the snapshot it gives back
+		unsigned long long int ticks;
+	} entries[REWINDMAX];
+	int      first, count;                                                        // oldest entry and number of entries
+	struct snapshot head;                                                         // the newest snapshot
+	struct snapshot scratch;                                                      // the next one
+	uint8_t  *encoded;                                                            // the difference, before it goes to the ring
+	long     encodedCapacity;
+	unsigned long long int headTicks;                                             // tick at which head was taken
+} history = { 0 };
+
+
+static inline unsigned long long int loadWord(const uint8_t *p, long pos, long size) {
+	unsigned long long int w = 0;                                                 // zeros past the end
+	if (pos + 8 <= size)
+		memcpy(&w, p + pos, 8);
+	else if (pos < size)
+		memcpy(&w, p + pos, size - pos);
+	return w;
+}
+
+
+static long zeroWords(const uint8_t *a, long aSize, const uint8_t *b, long bSize, long w) {
+	long words = (aSize + 7) / 8;                                                 // the first word of a differing from b
+#ifdef __SSE2__
+	long pairs = (aSize < bSize ? aSize : bSize) / 16 * 2;                        // two words at a time, inside both
+	const __m128i zero = _mm_setzero_si128();
+	while (w + 2 <= pairs) {
+		__m128i x = _mm_xor_si128(_mm_loadu_si128((const __m128i *)(a + w * 8)), _mm_loadu_si128((const __m128i *)(b + w * 8)));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(x, zero));
+		if (mask != 0xFFFF) break;
+		w += 2;
+	}
+#endif
+	while (w < words && loadWord(a, w * 8, aSize) == loadWord(b, w * 8, bSize)) w++;
+	return w;
+}
+
+
+static void putVarint(uint8_t **out, unsigned long value) {                     // 7 bits per byte
+	while (value >= 0x80) {
+		*(*out)++ = value | 0x80;
+		value >>= 7;
+	}
+	*(*out)++ = value;
+}
+
+
+static unsigned long getVarint(const uint8_t **in, const uint8_t *end) {
+	unsigned long value = 0;
+	for (int shift = 0; *in < end && shift < 35; shift += 7) {
+		uint8_t b = *(*in)++;
+		value |= (unsigned long)(b & 0x7F) << shift;
+		if (!(b & 0x80)) break;
+	}
+	return value;
+}
+
+
+static long xorEncode(const uint8_t *a, long aSize, const uint8_t *b, long bSize, uint8_t *out) {
+	uint8_t *start = out;                                                         // a, given b, at most aSize * 13 / 8 + 10 bytes
+	long words = (aSize + 7) / 8, w = 0;
+	while (w < words) {
+		long zeros = zeroWords(a, aSize, b, bSize, w) - w;
+		w += zeros;
+		if (w == words) break;                                                      // the end is implied
+		long literal = 0;
+		while (w + literal < words && loadWord(a, (w + literal) * 8, aSize) != loadWord(b, (w + literal) * 8, bSize))
+			literal++;
+		putVarint(&out, zeros);
+		putVarint(&out, literal);
+		for (long i = 0; i < literal; i++, w++) {
+			unsigned long long int x = loadWord(a, w * 8, aSize) ^ loadWord(b, w * 8, bSize);
+			long n = aSize - w * 8 < 8 ? aSize - w * 8 : 8;
+			memcpy(out, &x, n);                                                       // the last word may be partial
+			out += n;
+		}
+	}
+	return out - start;
+}
+
+
+static void xorDecode(const uint8_t *in, long length, const uint8_t *b, long bSize, uint8_t *a, long aSize) {
+	const uint8_t *end = in + length;
+	memcpy(a, b, aSize < bSize ? aSize : bSize);                                  // a = b, then the differences
+	if (aSize > bSize) memset(a + bSize, 0, aSize - bSize);
+	long pos = 0;
+	while (in < end) {
+		pos += getVarint(&in, end) * 8;
+		long literal = getVarint(&in, end) * 8;
+		for (long i = 0; i < literal && pos < aSize && in < end; i++) a[pos++] ^= *in++;
+	}
+}
+
+
+int historyInit(long megabytes, int frames) {                                   // 0 megabytes disables it
+	free(history.ring);
+	free(history.head.data);
+	free(history.scratch.data);
+	free(history.encoded);
+	memset(&history, 0, sizeof(history));
+	history.budget = megabytes << 20;
+	history.frames = frames > 0 ? frames : REWINDFRAMES;
+	history.countdown = history.frames;
+	if (!megabytes) return 1;
+	history.ring = malloc(history.budget);
+	return history.ring != NULL;
+}
+
+
+static void historyDrop() {                                                     // the oldest entry
+	history.first = (history.first + 1) % REWINDMAX;
+	history.count--;
+}
+
+
+static void historyPush(const uint8_t *delta, long need, long size, unsigned long long int at) {
+	long offset = 0;                                                              // need <= budget
+	if (history.count) {                                                          // right after the newest one
+		int last = (history.first + history.count - 1) % REWINDMAX;
+		offset = history.entries[last].offset + history.entries[last].length;
+		if (offset + need > history.budget) {                                       // back to the start of the ring :
+			while (history.count && history.entries[history.first].offset >= offset)  // the ones left up to its end go first
+				historyDrop();
+			offset = 0;
+		}
+	}
+	while (history.count) {                                                       // then the oldest ones in the way
+		int f = history.first;
+		bool overlap = history.entries[f].offset < offset + need && history.entries[f].offset + history.entries[f].length > offset;
+		if (!overlap && history.count < REWINDMAX) break;
+		historyDrop();
+	}
+	if (!history.count) offset = 0;
+
+	int e = (history.first + history.count++) % REWINDMAX;
+	history.entries[e].offset = offset;
+	history.entries[e].length = need;
+	memcpy(history.ring + offset, delta, need);
+	history.entries[e].size = size;
+	history.entries[e].ticks = at;
+}
+
+
+void historyCapture() {                                                         // called between two frames
+	if (!history.ring || --history.countdown > 0) return;
+	history.countdown = history.frames;
+	if (!saveState(&history.scratch, false)) return;                              // never nibblizes a track
+
+	struct snapshot *head = &history.head;
+	long worst = head->size * 13 / 8 + 16;
+	if (worst > history.encodedCapacity) {                                        // only while the snapshots grow
+		uint8_t *encoded = realloc(history.encoded, worst);
+		if (encoded) {
+			history.encoded = encoded;
+			history.encodedCapacity = worst;
+		}
+	}
+	long need = head->size && worst <= history.encodedCapacity ? xorEncode(head->data, head->size, history.scratch.data, history.scratch.size, history.encoded) : 0;
+	if (need && need <= history.budget)
+		historyPush(history.encoded, need, head->size, history.headTicks);
+
+	struct snapshot swap = *head;                                                 // the buffers are kept
+	*head = history.scratch;
+	history.scratch = swap;
+	history.headTicks = ticks;
+}
+
+
+int historyStep() {                                                             // one snapshot back, 0 if none left
+	struct snapshot *head = &history.head;
+	if (!history.ring || !head->size) return 0;
+	if (ticks != history.headTicks)                                               // first back to the last snapshot
+		return loadState(head);
+	if (!history.count) return 0;
+
+	int e = (history.first + history.count - 1) % REWINDMAX;
+	long size = history.entries[e].size;
+	if (size > history.scratch.capacity) {
+		uint8_t *data = realloc(history.scratch.data, size);
+		if (!data) return 0;
+		history.scratch.data = data;
+		history.scratch.capacity = size;
+	}
+	xorDecode(history.ring + history.entries[e].offset, history.entries[e].length, head->data, head->size, history.scratch.data, size);
+	history.scratch.size = size;
+	history.count--;
+
+	struct snapshot swap = *head;
+	*head = history.scratch;
+	history.scratch = swap;
+	history.headTicks = history.entries[e].ticks;
+	history.countdown = history.frames;
+	return loadState(head);
+}
+
+
+//======================================================================= MOVIES
+// a full snapshot to start from, then every input given to the machine as
+// {ticks, type, length, payload} records. Replayed from the same snapshot,
+// the events are applied at the same ticks and give the same machine state.
+// The snapshot holds the hard disk blocks too, a replay never writes them
+
+#define MOVIEVERSION 1
+
+THREADLOCAL struct movie movie = { 0 };
+
+
+void movieEvent(char type, const void *payload, int length) {                   // recorded at the current tick
+	if (movie.mode != RECORDING) return;
+	uint8_t header[11];
+	for (int i = 0; i < 8; i++) header[i] = ticks >> (i * 8);
+	header[8] = type;
+	header[9] = length;
+	header[10] = length >> 8;
+	fwrite(header, 1, 11, movie.file);
+	if (length) fwrite(payload, 1, length, movie.file);
+}
+
+
+void movieInsert(char type, int drv, const char *filename) {                    // 'I' floppy, 'T' tape or 'D' hard disk
+	char payload[401];
+	payload[0] = drv;
+	int length = snprintf(payload + 1, 400, "%s", filename);
+	movieEvent(type, payload, 1 + (length < 400 ? length : 399));
+}
+
+
+void movieMark() {                                                              // before the host changes the inputs
+	movie.KBD = KBD;
+	movie.PB0 = PB0;
+	movie.PB1 = PB1;
+	movie.PB2 = PB2;
+	movie.GCP[0] = GCP[0];
+	movie.GCP[1] = GCP[1];
+	movie.hleDisk = hleDisk;
+	movie.fastLoad = tape.fastLoad;
+}
+
+
+void movieInputs() {                                                            // and after : record them, or ignore them
+	if (movie.mode == PLAYING) {
+		KBD = movie.KBD;
+		PB0 = movie.PB0;
+		PB1 = movie.PB1;
+		PB2 = movie.PB2;
+		GCP[0] = movie.GCP[0];
+		GCP[1] = movie.GCP[1];
+		hleDisk = movie.hleDisk;
+		tape.fastLoad = movie.fastLoad;
+		return;
+	}
+	if (KBD != movie.KBD) movieEvent('K', &KBD, 1);
+	uint8_t *buttons[3] = { &PB0, &PB1, &PB2 }, *marks[3] = { &movie.PB0, &movie.PB1, &movie.PB2 };
+	for (int i = 0; i < 3; i++) {
+		uint8_t payload[2] = { i, *buttons[i] };
+		if (*buttons[i] != *marks[i]) movieEvent('B', payload, 2);
+	}
+	for (int i = 0; i < 2; i++) {
+		uint8_t payload[1 + sizeof(float)] = { i };
+		memcpy(payload + 1, &GCP[i], sizeof(float));
+		if (GCP[i] != movie.GCP[i]) movieEvent('P', payload, sizeof(payload));
+	}
+	if (hleDisk != movie.hleDisk) movieEvent('H', &(uint8_t){ hleDisk }, 1);
+	if (tape.fastLoad != movie.fastLoad) movieEvent('F', &(uint8_t){ tape.fastLoad }, 1);
+	movieMark();
+}
+
+
+void movieStop() {
+	if (movie.mode == RECORDING) {
+		movieEvent('E', NULL, 0);                                                   // the end, to know how long to run
+		fclose(movie.file);
+	}
+	free(movie.data);
+	movie.data = NULL;
+	movie.mode = NOMOVIE;
+}
+
+
+int movieRecord(char *filename) {                                               // from the current machine state
+	movieStop();
+	struct snapshot s = { 0 };
+	movie.file = saveState(&s, true) ? fopen(filename, "wb") : NULL;
+	if (!movie.file) {
+		free(s.data);
+		return 0;
+	}
+	uint8_t header[16] = { 'R', '2', 'M', 'O', 'V', 'I', 'E', 0 };
+	for (int i = 0; i < 4; i++) {
+		header[8 + i] = MOVIEVERSION >> (i * 8);
+		header[12 + i] = s.size >> (i * 8);
+	}
+	bool success = fwrite(header, 1, 16, movie.file) == 16 && fwrite(s.data, 1, s.size, movie.file) == s.size;
+	free(s.data);
+	if (!success) {
+		fclose(movie.file);
+		return 0;
+	}
+	movie.mode = RECORDING;
+	movieEvent('H', &(uint8_t){ hleDisk }, 1);                                    // the settings changing the execution
+	movieEvent('F', &(uint8_t){ tape.fastLoad }, 1);
+	movieMark();
+	return 1;
+}
+
+
+static void movieNext() {                                                       // tick of the next event, if any
+	if (movie.size - movie.pos < 11) {
+		movieStop();
+		return;
+	}
+	movie.next = 0;
+	for (int i = 0; i < 8; i++) movie.next |= (unsigned long long int)movie.data[movie.pos + i] << (i * 8);
+}
+
+
+int moviePlay(char *filename) {
+	movieStop();
+	FILE *f = fopen(filename, "rb");
+	if (!f) return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	rewind(f);
+	uint8_t *data = malloc(size > 16 ? size : 16);
+	bool success = data && fread(data, 1, size, f) == size;
+	fclose(f);
+
+	long length = success && size >= 16 ? data[12] | data[13] << 8 | data[14] << 16 | (long)data[15] << 24 : 0;
+	struct snapshot s = { .data = data + 16, .size = length };
+	if (!length || memcmp(data, "R2MOVIE", 8) || data[8] != MOVIEVERSION || length > size - 16 || !loadState(&s)) {
+		free(data);
+		return 0;
+	}
+	movie.data = data;
+	movie.size = size;
+	movie.pos = 16 + length;
+	movie.mode = PLAYING;
+	if (hdd.image) memset(hdd.dirty, 0, hdd.blocks * sizeof(bool));               // the image file keeps its content
+	movieMark();
+	movieNext();
+	return 1;
+}
+
+
+static void movieApply() {                                                      // the events due now
+	while (movie.mode == PLAYING && movie.next <= ticks) {
+		uint8_t *e = movie.data + movie.pos;
+		int length = e[9] | e[10] << 8;
+		if (length > movie.size - movie.pos - 11) {                                 // truncated
+			movieStop();
+			return;
+		}
+		uint8_t *p = e + 11;
+		char filename[400];
+		snprintf(filename, sizeof(filename), "%.*s", length > 1 ? length - 1 : 0, (char *)p + 1);
+		switch (e[8]) {
+			case 'K': movie.KBD = KBD = p[0]; break;
+			case 'Y': typeText((char *)p, length); break;
+			case 'W':                                                                 // memory written by the host
+				if (length > 2 && (p[0] | p[1] << 8) + length - 2 <= RAMSIZE)
+					memcpy(ram + (p[0] | p[1] << 8), p + 2, length - 2);
+				break;
+			case 'B': *(p[0] == 0 ? &PB0 : p[0] == 1 ? &PB1 : &PB2) = p[1]; break;
+			case 'P': memcpy(&GCP[p[0] & 1], p + 1, sizeof(float)); break;
+			case 'H': hleDisk = p[0] != 0; break;
+			case 'F': tape.fastLoad = p[0] != 0; break;
+			case 'R': pressReset(); break;
+			case 'C':                                                                 // cold reset
+				ram[0x3F4] = 0;
+				pressReset();
+				memset(ram, 0, sizeof(ram));
+				memset(aux, 0, sizeof(aux));
+				break;
+			case 'I': if (p[0] < DRIVES) loadFloppy(filename, p[0]); break;           // nothing written back
+			case 'T': insertTape(filename); break;
+			case 'D': loadHardDisk(filename); break;
+		}
+		movie.pos += 11 + length;
+		if (e[8] == 'E') {
+			movieStop();
+			return;
+		}
+		movieMark();
+		movieNext();
+	}
+}
+
+
+void movieMemory(uint16_t address, long length) {                               // ram changed by the host, as it is now
+	for (long done = 0; done < length; done += 0xFFF0) {                          // events are 64K at most
+		uint8_t payload[2 + 0xFFF0];
+		long size = length - done < 0xFFF0 ? length - done : 0xFFF0;
+		payload[0] = address + done;
+		payload[1] = (address + done) >> 8;
+		memcpy(payload + 2, ram + address + done, size);
+		movieEvent('W', payload, 2 + size);
+	}
+}
+
+
+void movieExec(unsigned long long int cycles) {                                 // puce6502Exec, stopping at the events
+	unsigned long long int target = ticks + cycles;
+	while (movie.mode == PLAYING && movie.next < target) {
+		if (movie.next > ticks) execute(movie.next - ticks);                        // stops right on it, as when recorded
+		movieApply();
+		if (movie.mode != PLAYING) return;                                          // where the recording ended
+	}
+	if (ticks < target) execute(target - ticks);
+}
+
+
+//=================================================================== RUN-AHEAD
+// the frame shown is emulated a few frames in advance with the current inputs,
+// from a snapshot restored once it is rendered : a key press shows up on
+// screen without waiting for the frames the game itself takes to react
+
+THREADLOCAL struct runAhead runAhead = { 0 };
+
+
+void runAheadStart() {                                                          // once the inputs of the frame are known
+	if (!runAhead.frames || tape.out || disksSpinning()) return;                  // (the disks run in warp anyway)
+	if (slots[2] == &serialCard) return;                                          // the bytes exchanged can't be taken back
+	if (!saveState(&runAhead.state, false)) return;
+	ahead = true;
+	for (int i = 0; i < runAhead.frames; i++)
+		puce6502Exec(FRAMECYCLES);
+}
+
+
+void runAheadStop() {                                                           // once the frame is rendered
+	if (!ahead) return;
+	loadState(&runAhead.state);                                                   // doesn't flush the floppies
+	ahead = false;
+}
+
+
+//======================================================================== RUNS
+// the machine run unthrottled, by the headless front end and the batch runner
+
+void resetMachine() {                                                           // back to power on, no media inserted
+	movieStop();
+	if (tape.out) recordTape(NULL);
+	free(tape.edges);
+	free(tape.bytes);
+	free(tape.blocks);
+	tape = (struct cassette){ .fastLoad = true };
+	for (int drv = 0; drv < DRIVES; drv++) {
+		ejectFloppy(drv);
+		disk[drv] = (struct drive){ 0 };
+	}
+	diskII[0] = (struct controller){ true, 0 };
+	diskII[1] = (struct controller){ false, 2 };
+	plugCard(5, NULL);
+	dropHardDisk();
+	historyInit(0, 0);
+	free(runAhead.state.data);
+	runAhead = (struct runAhead){ 0 };
+
+	free(typeAhead.keys);
+	typeAhead = (struct typeAhead){ 0 };
+
+	memset(ram, 0, sizeof(ram));
+	memset(lgc, 0, sizeof(lgc));
+	memset(bk2, 0, sizeof(bk2));
+	memset(aux, 0, sizeof(aux));
+	setLanguageCard(16);
+	setApple2e(false);
+	setVidex(false);
+	closeSerial();
+	plugCard(2, NULL);
+	acia = (struct acia){ .status = TDRE };
+	KBD = 0;
+	TEXT = true;
+	MIXED = PAGE2 = HIRES = false;
+	LCWR = LCBK2 = true;
+	LCRD = LCWFF = AN0 = false;
+	mapMemory();
+	PB0 = PB1 = PB2 = 0;
+	for (int i = 0; i < 2; i++) {
+		GCP[i] = 127.0f;
+		GCC[i] = 0.0f;
+		GCD[i] = GCA[i] = 0;
+	}
+	GCCrigger = 0;
+	hleDisk = warp = ahead = SPKR = false;
+	runAddress = -1;
+	speakerTick = 0;
+	ticks = 0;
+}
+
+
+static bool conditionMet(struct run *r) {                                       // checked between two frames
+	if (r->text) {
+		char text[TEXTSIZE];
+		screenText(text);
+		if (strstr(text, r->text)) return true;
+	}
+	return r->memAddress >= 0 && peek(r->memAddress) == r->memValue;
+}
+
+
+int runMachine(struct run *r) {                                                 // 1 once a condition is met
+	unsigned long long int end = r->limit ? ticks + r->limit : ~0ULL;             // no limit : the end of the movie
+	bool met = false;
+	while (!met && ticks < end && (r->limit || movie.mode == PLAYING)) {
+		unsigned long long int cycles = end - ticks < FRAMECYCLES ? end - ticks : FRAMECYCLES;
+		if (r->pc >= 0) {                                                           // one instruction at a time
+			unsigned long long int frameEnd = ticks + cycles;
+			while (ticks < frameEnd && !(met = getPC() == r->pc))
+				movieExec(1);
+		} else {
+			movieExec(cycles);
+		}
+		if (r->flush && movie.mode != PLAYING) flushFloppies();
+		met = met || conditionMet(r);
+	}
+	return met;
+}
+
+
+//=================================================================== APPLESOFT
+// a listing is tokenized as Applesoft does when the lines are typed, and put
+// right into memory at TXTTAB with the pointers a LOAD would leave. And back
+
+#define CH     0x24                                                             // zero page : cursor column
+#define BASL   0x28                                                             // cursor line address
+#define PROMPT 0x33                                                             // the prompt character of GETLN
+#define TXTTAB 0x67                                                             // pointers : program start
+#define VARTAB 0x69                                                             // simple variables start
+#define ARYTAB 0x6B                                                             // arrays start
+#define STREND 0x6D                                                             // arrays end
+#define FRETOP 0x6F                                                             // strings start, growing down
+#define MEMSIZE 0x73                                                            // HIMEM
+#define DATPTR 0x7D                                                             // next DATA to READ
+#define PRGEND 0xAF                                                             // program end
+
+static const char *tokens[] = {                                                 // $80 to $EA, in the ROM order
+	"END", "FOR", "NEXT", "DATA", "INPUT", "DEL", "DIM", "READ", "GR", "TEXT", "PR#", "IN#",
+	"CALL", "PLOT", "HLIN", "VLIN", "HGR2", "HGR", "HCOLOR=", "HPLOT", "DRAW", "XDRAW", "HTAB",
+	"HOME", "ROT=", "SCALE=", "SHLOAD", "TRACE", "NOTRACE", "NORMAL", "INVERSE", "FLASH",
+	"COLOR=", "POP", "VTAB", "HIMEM:", "LOMEM:", "ONERR", "RESUME", "RECALL", "STORE", "SPEED=",
+	"LET", "GOTO", "RUN", "IF", "RESTORE", "&", "GOSUB", "RETURN", "REM", "STOP", "ON", "WAIT",
+	"LOAD", "SAVE", "DEF", "POKE", "PRINT", "CONT", "LIST", "CLEAR", "GET", "NEW", "TAB(", "TO",
+	"FN", "SPC(", "THEN", "AT", "NOT", "STEP", "+", "-", "*", "/", "^", "AND", "OR", ">", "=",
+	"<", "SGN", "INT", "ABS", "USR", "FRE", "SCRN(", "PDL", "POS", "SQR", "RND", "LOG", "EXP",
+	"COS", "SIN", "TAN", "ATN", "PEEK", "LEN", "STR$", "VAL", "ASC", "CHR$", "LEFT$", "RIGHT$",
+	"MID$"
+};
+
+#define TOKENS  (sizeof(tokens) / sizeof(tokens[0]))
+#define TOKLEN  7                                                               // the longest ones, HCOLOR= or RESTORE
+#define LINELEN (255 * (TOKLEN + 2) + 16)                                       // a line listed, 255 tokens at most
+#define TOKDATA 0x83
+#define TOKREM  0xB2
+#define TOKAT   0xC5
+#define TOKPRINT 0xBA
+
+struct basicLine {
+	long     number;
+	long     order;                                                               // in the listing, the last one wins
+	int      length;
+	uint8_t  bytes[256];                                                          // tokenized, without the final 0
+};
+
+
+static int matchToken(const char *text, long *pos, long end) {                  // the token at pos, -1 if none
+	for (int t = 0; t < (int)TOKENS; t++) {
+		long p = *pos;
+		const char *k = tokens[t];
+		while (*k) {                                                                // blanks are skipped while matching
+			while (p < end && text[p] == ' ') p++;
+			if (p == end || toupper((unsigned char)text[p]) != *k) break;
+			p++;
+			k++;
+		}
+		if (*k) continue;
+		if (t + 0x80 == TOKAT) {                                                    // ATN, or A TO
+			long n = p;
+			while (n < end && text[n] == ' ') n++;
+			if (n < end && (toupper((unsigned char)text[n]) == 'N' || toupper((unsigned char)text[n]) == 'O'))
+				continue;
+		}
+		*pos = p;
+		return t + 0x80;
+	}
+	return -1;
+}
+
+
+static int tokenizeLine(const char *text, long end, struct basicLine *line) {   // 0 if no line number
+	long pos = 0;
+	line->number = -1;
+	line->length = 0;
+	while (pos < end && (text[pos] == ' ' || (text[pos] >= '0' && text[pos] <= '9'))) {
+		if (text[pos] != ' ') line->number = (line->number < 0 ? 0 : line->number * 10) + text[pos] - '0';
+		if (line->number > 63999) return 0;
+		pos++;
+	}
+	if (line->number < 0) return 0;
+
+	bool quoted = false, data = false;
+	while (pos < end && line->length < 250) {
+		char c = text[pos];
+		int token = -1;
+		if (quoted || (data && c != ':')) {                                         // copied as is
+			if (c == '"') quoted = !quoted;
+			pos++;
+		} else if (c == ' ') {
+			pos++;
+			continue;
+		} else if (c == '?') {
+			token = TOKPRINT;
+			pos++;
+		} else if ((c >= '0' && c <= ';') || (token = matchToken(text, &pos, end)) < 0) {
+			c = toupper((unsigned char)c);
+			if (c == '"') quoted = true;
+			if (c == ':') data = false;
+			pos++;
+		}
+		if (token >= 0) {
+			line->bytes[line->length++] = token;
+			if (token == TOKDATA) data = true;
+			if (token == TOKREM) {                                                    // the rest of the line as is
+				while (pos < end && line->length < 250) line->bytes[line->length++] = text[pos++] & 0x7F;
+				return 1;
+			}
+		} else {
+			line->bytes[line->length++] = c & 0x7F;
+		}
+	}
+	return 1;
+}
+
+
+static int compareLines(const void *a, const void *b) {
+	const struct basicLine *x = a, *y = b;
+	if (x->number != y->number) return x->number < y->number ? -1 : 1;
+	return x->order < y->order ? -1 : 1;
+}
+
+
+bool basicPrompt() {                                                            // Applesoft waits for a command
+	int start = ram[TXTTAB] | ram[TXTTAB + 1] << 8, himem = ram[MEMSIZE] | ram[MEMSIZE + 1] << 8;
+	int cursor = (ram[BASL] | ram[BASL + 1] << 8) + ram[CH] - 1;                  // right after the ] of the line
+	return ram[PROMPT] == 0xDD && cursor >= 0x400 && cursor < 0xC00 && ram[cursor] == 0xDD
+	       && start >= 0x0801 && start < himem && himem <= RAMSIZE;
+}
+
+
+int loadBasic(const char *text, long length) {                                  // 0 if not a listing, or too large
+	int start = ram[TXTTAB] | ram[TXTTAB + 1] << 8, himem = ram[MEMSIZE] | ram[MEMSIZE + 1] << 8;
+	if (start < 0x0801 || start >= himem || himem > RAMSIZE) return 0;            // Applesoft isn't started
+
+	struct basicLine *lines = NULL;
+	long count = 0, capacity = 0;
+	for (long pos = 0; pos < length; ) {
+		long end = pos;
+		while (end < length && text[end] != '\n' && text[end] != '\r') end++;
+		long blank = pos;
+		while (blank < end && text[blank] == ' ') blank++;
+		if (blank < end) {                                                          // empty lines are skipped
+			if (count == capacity) {
+				capacity = capacity ? capacity * 2 : 256;
+				struct basicLine *bigger = realloc(lines, capacity * sizeof(struct basicLine));
+				if (!bigger) {
+					free(lines);
+					return 0;
+				}
+				lines = bigger;
+			}
+			lines[count].order = count;
+			if (!tokenizeLine(text + pos, end - pos, &lines[count])) {
+				free(lines);
+				return 0;
+			}
+			count++;
+		}
+		pos = end + 1;
+	}
+	qsort(lines, count, sizeof(struct basicLine), compareLines);
+
+	long address = start;
+	for (long i = 0; i < count; i++) {
+		struct basicLine *l = &lines[i];
+		if ((i + 1 < count && lines[i + 1].number == l->number) || !l->length)
+			continue;                                                                 // replaced, or deleted by a bare number
+		if (address + 5 + l->length + 2 > himem) {
+			free(lines);
+			return 0;
+		}
+		long next = address + 5 + l->length;
+		ram[address] = next;
+		ram[address + 1] = next >> 8;
+		ram[address + 2] = l->number;
+		ram[address + 3] = l->number >> 8;
+		memcpy(ram + address + 4, l->bytes, l->length);
+		ram[next - 1] = 0;
+		address = next;
+	}
+	free(lines);
+	ram[start - 1] = 0;
+	ram[address] = ram[address + 1] = 0;                                          // the null link ending the program
+	address += address == start ? 3 : 2;                                          // a spare byte for an empty one, as NEW leaves it
+
+	int pointers[] = { VARTAB, ARYTAB, STREND, PRGEND };                          // as a LOAD, then CLEAR, leave them
+	for (int i = 0; i < 4; i++) {
+		ram[pointers[i]] = address;
+		ram[pointers[i] + 1] = address >> 8;
+	}
+	ram[FRETOP] = himem;
+	ram[FRETOP + 1] = himem >> 8;
+	ram[DATPTR] = start - 1;
+	ram[DATPTR + 1] = (start - 1) >> 8;
+
+	movieMemory(start - 1, address - start + 1);
+	movieMemory(TXTTAB, PRGEND + 2 - TXTTAB);
+	return 1;
+}
+
+
+char *listBasic() {                                                             // the program as text, NULL if none
+	long address = ram[TXTTAB] | ram[TXTTAB + 1] << 8;
+	long size = 0, capacity = 4096;
+	char *text = malloc(capacity);
+	if (!text || address < 0x0801 || address >= RAMSIZE) {
+		free(text);
+		return NULL;
+	}
+
+	for (int lines = 0; address + 4 < RAMSIZE && (ram[address] | ram[address + 1]) && lines < 0x8000; lines++) {
+		if (capacity - size < LINELEN) {                                            // room for the longest line
+			char *bigger = realloc(text, capacity *= 2);
+			if (!bigger) {
+				free(text);
+				return NULL;
+			}
+			text = bigger;
+		}
+		size += sprintf(text + size, "%d ", ram[address + 2] | ram[address + 3] << 8);
+		bool quoted = false, space = false;                                         // a space is due after a word
+		long pos = address + 4, end = address + 4 + 255;
+		for (; pos < RAMSIZE && pos < end && ram[pos]; pos++) {
+			uint8_t b = ram[pos];
+			if (b < 0x80 || quoted || b - 0x80 >= (int)TOKENS) {
+				if (space && (isalnum(b) || b == '"' || b == '.')) text[size++] = ' ';
+				text[size++] = b & 0x7F;
+				if (b == '"') quoted = !quoted;
+				space = false;
+				continue;
+			}
+			const char *t = tokens[b - 0x80];
+			char last = text[size - 1];
+			if (isalpha((unsigned char)t[0]) && (space || isalnum((unsigned char)last) || last == '"' || last == ')' || last == '$'))
+				text[size++] = ' ';                                                     // words are kept apart
+			size += sprintf(text + size, "%s", t);
+			space = isalpha((unsigned char)t[strlen(t) - 1]) != 0;
+			if (b == TOKREM) {                                                        // as it was typed
+				while (++pos < RAMSIZE && pos < end && ram[pos]) text[size++] = ram[pos] & 0x7F;
+				break;
+			}
+		}
+		text[size++] = '\n';
+		long next = ram[address] | ram[address + 1] << 8;
+		if (next <= address) break;                                                 // a broken link
+		address = next;
+	}
+	text[size] = 0;
+	return text;
+}
+
+
+//======================================================================= VIDEO
+
+uint8_t textGlyph(uint8_t value, bool flash, bool *reverse) {                   // its index in the fonts, flash : FLASH shows inverse
+	if (apple2e && (value >= 0xE0 || (value >= 0x60 && value < 0x80 && ALTCHAR))) {
+		*reverse = value < 0x80;                                                    // lower case, inverse with ALTCHAR
+		return value & 0x7F;
+	}
+	*reverse = value < 0x40 || (value < 0x80 && (flash || (apple2e && ALTCHAR)));  // INVERSE, or FLASH half of the time
+	value &= 0x7F;
+	if (value > 0x5F) value &= 0x3F;                                              // shifts to match
+	if (value < 0x20) value |= 0x40;                                              // the ASCII codes
+	return value;
+}
+
+
+uint8_t textByte(int line, int col, int columns) {                              // of the page displayed, 40 or 80 columns
+	uint16_t address = 0x400 + (PAGE2 && !STORE80) * 0x0400 + offsetGR[line];
+	if (columns == 40) return ram[address + col];
+	return col & 1 ? ram[address + col / 2] : aux[address + col / 2];             // aux holds the even columns
+}
+
+
+void screenText(char *text) {                                                   // 24 lines of 40 or 80 characters, TEXTSIZE
+	if (videxShown()) {                                                           // ascii, bit 7 for inverse
+		for (int line = 0; line < VIDEXROWS; line++) {
+			for (int col = 0; col < VIDEXCOLUMNS; col++) {
+				uint8_t c = col < videx.crtc[1] ? videx.ram[videxAddress(line, col)] & 0x7F : ' ';
+				*text++ = c < 0x20 || c == 0x7F ? ' ' : c;
+			}
+			*text++ = '\n';
+		}
+		*text = 0;
+		return;
+	}
+	int columns = apple2e && COL80 ? 80 : 40;
+	bool reverse;
+	for (int line = 0; line < 24; line++) {
+		for (int col = 0; col < columns; col++)
+			*text++ = textGlyph(textByte(line, col, columns), false, &reverse);       // NORMAL, INVERSE or FLASH alike
+		*text++ = '\n';
+	}
+	*text = 0;
+}
+
+
+const int color[16][3] = {                                                      // the 16 low res colors
+	{ 0,   0,   0	  }, { 226, 57,  86  }, { 28,  116, 205 }, { 126, 110, 173 },
+	{ 31,  129, 128 }, { 137, 130, 122 }, { 86,  168, 228 }, { 144, 178, 223 },
+	{ 151, 88,  34	}, { 234, 108, 21  }, { 158, 151, 143 }, { 255, 206, 240 },
+	{ 144, 192, 49	}, { 255, 253, 166 }, { 159, 210, 213 }, { 255, 255, 255 }
+};
+
+
+const int hcolor[16][3] = {                                                     // the high res colors (2 light levels)
+	{ 0,   0,   0   }, { 144, 192, 49  }, { 126, 110, 173 }, { 255, 255, 255 },
+	{ 0,   0,   0   }, { 234, 108, 21  }, { 86,  168, 228 }, { 255, 255, 255 },
+	{ 0,   0,   0   }, { 63,  55,	 86  }, { 72,  96,  25	}, { 255, 255, 255 },
+	{ 0,   0,   0   }, { 43,  84,	 114 }, { 117, 54,  10	}, { 255, 255, 255 }
+};
+
+
+const int offsetGR[24] = {                                                      // helper for TEXT and GR video generation
+	0x0000, 0x0080, 0x0100, 0x0180, 0x0200, 0x0280, 0x0300, 0x0380,               // lines 0-7
+	0x0028, 0x00A8, 0x0128, 0x01A8, 0x0228, 0x02A8, 0x0328, 0x03A8,               // lines 8-15
+	0x0050, 0x00D0, 0x0150, 0x01D0, 0x0250, 0x02D0, 0x0350, 0x03D0                // lines 16-23
+};
+
+
+const int offsetHGR[192] = {                                                    // helper for HGR video generation
+	0x0000, 0x0400, 0x0800, 0x0C00, 0x1000, 0x1400, 0x1800, 0x1C00,               // lines 0-7
+	0x0080, 0x0480, 0x0880, 0x0C80, 0x1080, 0x1480, 0x1880, 0x1C80,               // lines 8-15
+	0x0100, 0x0500, 0x0900, 0x0D00, 0x1100, 0x1500, 0x1900, 0x1D00,               // lines 16-23
+	0x0180, 0x0580, 0x0980, 0x0D80, 0x1180, 0x1580, 0x1980, 0x1D80,
+	0x0200, 0x0600, 0x0A00, 0x0E00, 0x1200, 0x1600, 0x1A00, 0x1E00,
+	0x0280, 0x0680, 0x0A80, 0x0E80, 0x1280, 0x1680, 0x1A80, 0x1E80,
+	0x0300, 0x0700, 0x0B00, 0x0F00, 0x1300, 0x1700, 0x1B00, 0x1F00,
+	0x0380, 0x0780, 0x0B80, 0x0F80, 0x1380, 0x1780, 0x1B80, 0x1F80,
+	0x0028, 0x0428, 0x0828, 0x0C28, 0x1028, 0x1428, 0x1828, 0x1C28,
+	0x00A8, 0x04A8, 0x08A8, 0x0CA8, 0x10A8, 0x14A8, 0x18A8, 0x1CA8,
+	0x0128, 0x0528, 0x0928, 0x0D28, 0x1128, 0x1528, 0x1928, 0x1D28,
+	0x01A8, 0x05A8, 0x09A8, 0x0DA8, 0x11A8, 0x15A8, 0x19A8, 0x1DA8,
+	0x0228, 0x0628, 0x0A28, 0x0E28, 0x1228, 0x1628, 0x1A28, 0x1E28,
+	0x02A8, 0x06A8, 0x0AA8, 0x0EA8, 0x12A8, 0x16A8, 0x1AA8, 0x1EA8,
+	0x0328, 0x0728, 0x0B28, 0x0F28, 0x1328, 0x1728, 0x1B28, 0x1F28,
+	0x03A8, 0x07A8, 0x0BA8, 0x0FA8, 0x13A8, 0x17A8, 0x1BA8, 0x1FA8,
+	0x0050, 0x0450, 0x0850, 0x0C50, 0x1050, 0x1450, 0x1850, 0x1C50,
+	0x00D0, 0x04D0, 0x08D0, 0x0CD0, 0x10D0, 0x14D0, 0x18D0, 0x1CD0,
+	0x0150, 0x0550, 0x0950, 0x0D50, 0x1150, 0x1550, 0x1950, 0x1D50,
+	0x01D0, 0x05D0, 0x09D0, 0x0DD0, 0x11D0, 0x15D0, 0x19D0, 0x1DD0,
+	0x0250, 0x0650, 0x0A50, 0x0E50, 0x1250, 0x1650, 0x1A50, 0x1E50,
+	0x02D0, 0x06D0, 0x0AD0, 0x0ED0, 0x12D0, 0x16D0, 0x1AD0, 0x1ED0,               // lines 168-183
+	0x0350, 0x0750, 0x0B50, 0x0F50, 0x1350, 0x1750, 0x1B50, 0x1F50,               // lines 176-183
+	0x03D0, 0x07D0, 0x0BD0, 0x0FD0, 0x13D0, 0x17D0, 0x1BD0, 0x1FD0                // lines 184-191
+};
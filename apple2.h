@@ -0,0 +1,427 @@
+/*
+ * Reinette II plus, a french Apple II emulator
+ * the machine itself, shared by the SDL2 and the headless front ends
+ * Copyright (c) 2020 Arthur Ferreira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef _APPLE2_H
+#define _APPLE2_H
+
+#include <stdio.h>
+
+#include "puce6502.h"
+
+
+// memory layout
+#define RAMSIZE  0xC000
+#define ROMSTART 0xD000
+#define ROMSIZE  0x3000
+extern THREADLOCAL uint8_t ram[RAMSIZE];                                        // 48K of ram in $000-$BFFF
+extern uint8_t rom[ROMSIZE];                                                    // 12K of rom in $D000-$FFFF
+
+// language card
+#define LGCSTART 0xD000
+#define LGCSIZE  0x3000
+#define BK2START 0xD000
+#define BK2SIZE  0x1000
+extern THREADLOCAL uint8_t lgc[LGCSIZE];                                        // Language Card 12K in $D000-$FFFF
+extern THREADLOCAL uint8_t bk2[BK2SIZE];                                        // bank 2 of Language Card 4K in $D000-$DFFF
+
+// a Saturn card : more 16K banks of language card
+#define SATURNBANK 0x4000
+struct saturn {
+	int      banks;                                                               // of 16K, 1 for a plain language card
+	int      bank;                                                                // the one in $D000-$FFFF
+	uint8_t  *extra;                                                              // banks 1 and up, bank 0 being lgc and bk2
+};
+extern THREADLOCAL struct saturn saturn;
+
+// the memory seen by the cpu, page by page
+extern THREADLOCAL uint8_t *readPages[256];                                     // NULL for the I/O space
+extern THREADLOCAL uint8_t *writePages[256];                                    // NULL for the I/O space and the ROM
+
+uint8_t *languageRam(uint16_t address);                                         // in the banks selected, $D000-$FFFF
+int setLanguageCard(int kilobytes);                                             // 16 for a plain card, up to 128
+
+// disk ][ prom
+#define SL6SIZE  0x0100
+extern uint8_t sl6[SL6SIZE];                                                    // P5A disk ][ prom in slot 6 (and 5)
+
+// the //e
+#define AUXSIZE    0x10000
+#define IIEROMSIZE 0x4000
+extern THREADLOCAL uint8_t aux[AUXSIZE];                                        // 64K of auxiliary memory, its LC in $C000-$FFFF
+extern uint8_t romIIe[IIEROMSIZE];                                              // 16K of //e rom in $C000-$FFFF
+
+// the Videx Videoterm
+#define VIDEXROMSIZE  0x0400
+#define VIDEXFONTSIZE 0x0800
+#define VIDEXRAMSIZE  0x0800
+extern uint8_t videxRom[VIDEXROMSIZE];                                          // 1K of firmware in $C300 and $C800-$CBFF
+extern uint8_t videxFont[VIDEXFONTSIZE];                                        // character rom, 128 glyphs of 16 lines
+
+#define CPUFREQ  1023000                                                        // tape edges are stored in cpu cycles
+#define FRAMECYCLES 17050                                                       // 1/60 of a second
+
+
+//================================================== IMPLEMENTED BY THE FRONT END
+
+void queueSound(bool level, unsigned int length);                               // a speaker toggle, length in 1/96000 s
+void floppyInserted(int drv);                                                   // a drive got a new floppy
+void floppyNotSaved(int drv);                                                   // its changes could not be written back
+
+
+//================================================================ SOFT SWITCHES
+
+extern THREADLOCAL uint8_t KBD;
+extern THREADLOCAL bool TEXT, MIXED, PAGE2, HIRES;
+extern THREADLOCAL bool LCWR, LCRD, LCBK2, LCWFF;
+extern THREADLOCAL bool AN0;                                                    // shows the Videx screen in TEXT mode
+extern THREADLOCAL bool apple2e;                                                // an Apple //e instead of a II plus
+extern THREADLOCAL bool STORE80, RAMRD, RAMWRT, INTCXROM, ALTZP, SLOTC3ROM, INTC8ROM;
+extern THREADLOCAL bool COL80, ALTCHAR, DHIRES;
+
+uint8_t softSwitches(uint16_t address, uint8_t value, bool WRT);
+uint8_t readMem(uint16_t address);
+void writeMem(uint16_t address, uint8_t value);
+uint8_t peek(uint16_t address);
+int setApple2e(bool on);                                                        // 0 if the //e rom was not loaded
+void pressReset();                                                              // the RESET key
+
+
+//======================================================================== SLOTS
+
+struct card {                                                                   // any of the handlers can be NULL
+	uint8_t (*io)(int slot, uint16_t address, uint8_t value, bool WRT);           // device select $C0n0-$C0nF, n = slot + 8
+	uint8_t (*rom)(int slot, uint16_t address, uint8_t value, bool WRT);          // I/O select $Cn00-$CnFF
+	uint8_t (*expansion)(int slot, uint16_t address, uint8_t value, bool WRT);    // $C800-$CFFE, once the card is selected
+};
+
+extern const struct card languageCard, saturnCard, diskIICard, hardDiskCard, videxCard;
+
+extern THREADLOCAL const struct card *slots[8];                                 // slot 0 holds the language card
+extern THREADLOCAL int expansionSlot;                                           // the card owning $C800-$CFFE, 0 for none
+
+void plugCard(int slot, const struct card *card);                               // NULL empties the slot
+
+
+// the Videx Videoterm in slot 3, 80 x 24 glyphs of 8 x 9 dots
+#define VIDEXCOLUMNS 80
+#define VIDEXROWS    24
+#define VIDEXLINES   9                                                          // of a glyph, 640 x 216 dots
+#define VIDEXALLROWS ((1ul << VIDEXROWS) - 1)
+
+struct videx {
+	uint8_t  ram[VIDEXRAMSIZE];                                                   // the screen
+	uint8_t  crtc[18];                                                            // the 6845 registers
+	uint8_t  reg;                                                                 // the one selected
+	int      bank;                                                                // 512 bytes of ram in $CC00-$CDFF
+	unsigned long dirty;                                                          // rows to redraw, one bit each
+	bool     blink;                                                               // the cursor was shown
+};
+
+extern THREADLOCAL struct videx videx;
+
+int setVidex(bool on);                                                          // 0 if its roms were not loaded
+bool videxShown();                                                              // instead of the 40 columns text
+unsigned long videxRows();                                                      // to redraw since the last call, one bit per row
+uint8_t videxDots(int row, int line, int col);                                  // 8 dots of a glyph line, bit 7 on the left
+
+
+//===================================================================== KEYBOARD
+
+struct typeAhead {
+	uint8_t  *keys;                                                               // typed by the host, bit 7 set
+	long     count, pos;                                                          // queued, and the next one to give
+	long     capacity;                                                            // bytes allocated
+	bool     unread;                                                              // KBD holds a typed key not read yet
+};
+
+extern THREADLOCAL struct typeAhead typeAhead;
+
+int typeText(const char *text, long length);
+bool keysPending();
+
+
+//====================================================================== PADDLES
+
+extern THREADLOCAL uint8_t PB0, PB1, PB2;
+extern THREADLOCAL float GCP[2];                                                // GC Position ranging from 0 (left) to 255 right
+extern THREADLOCAL float GCC[2];
+extern THREADLOCAL int GCD[2];                                                  // GC0 and GC1 Directions (left/down or right/up)
+extern THREADLOCAL int GCA[2];                                                  // GC0 and GC1 Action (push or release)
+extern THREADLOCAL long long int GCCrigger;
+
+
+//====================================================================== SPEAKER
+
+extern THREADLOCAL bool warp;                                                   // unthrottled execution, sound is not queued
+extern THREADLOCAL bool ahead;                                                  // frames run ahead, to be thrown away
+extern THREADLOCAL bool SPKR;
+extern THREADLOCAL long long int speakerTick;
+
+
+//===================================================================== CASSETTE
+
+#define WAVRATE  44100                                                          // sample rate of the recorded tapes
+
+struct cassette {
+	char     filename[400];                                                       // the wav file in the tape deck
+	unsigned long long int *edges;                                                // tick of every level change since the tape start
+	int      edgeCount;                                                           // number of level changes
+	int      edgeIdx;                                                             // next edge to come under the head
+	bool     playing;                                                             // play is pressed on the first $C060 read
+	unsigned long long int start;                                                 // tick at which play was pressed
+	uint8_t  *bytes;                                                              // decoded blocks, for the fast load
+	int      *blocks;                                                             // size of each decoded block (checksum included)
+	int      blockCount;                                                          // number of decoded blocks
+	int      blockIdx;                                                            // next block to be read by the fast load
+	int      byteIdx;                                                             // offset of this block into bytes
+	bool     fastLoad;                                                            // trap the Monitor READ routine
+	FILE     *out;                                                                // wav file capturing $C020, NULL if not recording
+	unsigned long long int outTick;                                               // tick of the last $C020 toggle
+	bool     outLevel;                                                            // $C020 TAPEOUT flip flop
+};
+
+extern THREADLOCAL struct cassette tape;
+
+bool hasExtension(const char *filename, const char *ext);
+void rewindTape();
+int insertTape(char *filename);
+int recordTape(char *filename);
+
+
+//====================================================================== DISK ][
+
+#define NIBSIZE  232960                                                         // 35 tracks of 0x1A00 nibbles
+#define DSKSIZE  143360                                                         // 35 tracks of 16 sectors of 256 bytes
+#define TRKSIZE  0x1A00                                                         // nibbles per track
+#define TRACKS   35
+#define WOZTRKS  160                                                            // TRK entries in a WOZ 2 image
+#define NIBTICKS 32                                                             // cycles per nibble, 8 bits of 4us
+#define CONTROLLERS 2                                                           // disk ][ cards in slot 6, then slot 5
+#define DRIVES   (CONTROLLERS * 2)                                              // drive n is on controller n / 2
+
+enum format { NIB, DO, PO, WOZ };                                               // nibbles, DOS 3.3 order, ProDOS order or bits
+
+struct drive {
+	char		 filename[400];                                                       // the full disk image pathname
+	bool		 readOnly;                                                            // based on the image file attributes
+	int      format;                                                              // NIB, DO, PO or WOZ
+	uint8_t	 *image;                                                              // the image file, as loaded
+	long     size;                                                                // and its size
+	uint8_t	 *tracks[TRACKS];                                                     // nibblelized tracks, NULL until first accessed
+	bool     dirty[WOZTRKS];                                                      // tracks written to since the last save
+	bool     written[WOZTRKS];                                                    // tracks written to since the insertion
+	bool     compressed;                                                          // changes go to a .delta file, not to the image
+	bool     changed[WOZTRKS];                                                    // tracks saved into the .delta file
+	struct sharedImage *shared;                                                   // the image as inserted, read by other drives too
+	bool		 motorOn;                                                             // motor status
+	unsigned long long int motorStop;                                             // tick at which the motor stops, 0 if it runs
+	bool     flush;                                                               // the dirty tracks are written when the motor stops
+	bool     saveFailed;                                                          // they could not be, tried again on the next stop
+	bool		 writeMode;                                                           // the head is writing
+	uint8_t	 halfTrack;                                                           // head position, in half tracks
+	uint8_t	 track;                                                               // current track position
+	uint16_t nibble;                                                              // ptr to nibble under head position
+	unsigned long long int nibbleTick;                                            // tick at which this nibble was complete
+	uint8_t	 *tmap;                                                               // WOZ : quarter track -> TRK index, in image
+	uint8_t	 *trks;                                                               // WOZ : TRK entries (bits location and count)
+	int      bitTiming;                                                           // WOZ : bit cell duration in 125ns units
+	int      trk;                                                                 // WOZ : TRK index under the head, 0xFF if none
+	unsigned int bitPos;                                                          // WOZ : bit under the head
+	unsigned long long int bitTick;                                               // WOZ : tick at which bitPos was last updated
+	int      bitFrac;                                                             // WOZ : remainder of the last update, in 1/8 cycles
+	uint8_t	 latch;                                                               // WOZ : read shift register
+	bool     held;                                                                // WOZ : a complete nibble is kept one more bit cell
+	uint8_t	 heldBit;                                                             // WOZ : the bit arrived meanwhile
+	int      writtenBits;                                                         // WOZ : bits of the data latch already written
+};
+
+struct controller {
+	bool     enabled;                                                             // a card is plugged in the slot
+	int      curDrv;                                                              // current drive - only one can be enabled at a time
+	bool     phases[2][4];                                                        // stepper phases states (for both drives)
+	uint8_t  dLatch;                                                              // I/O register
+};
+
+extern THREADLOCAL struct drive disk[DRIVES];
+extern THREADLOCAL struct controller diskII[CONTROLLERS];
+extern THREADLOCAL bool hleDisk;                                                // high level emulation of the disk accesses
+
+int saveFloppy(int drive);
+int insertFloppy(char *filename, int drv);
+void flushFloppies();
+bool disksSpinning();
+
+
+//=================================================================== HARD DISK
+
+struct hardDisk {
+	char     filename[400];                                                       // the .po or .hdv image pathname
+	bool     readOnly;                                                            // based on the image file attributes
+	uint8_t  *image;                                                              // the whole image, as the Apple II sees it
+	uint8_t  *base;                                                               // as loaded, NULL until the first write
+	long     blocks;                                                              // its size in blocks
+	bool     *dirty;                                                              // blocks written to since the last save
+	bool     *written;                                                            // blocks written to since the insertion
+};
+
+extern THREADLOCAL struct hardDisk hdd;
+
+int saveHardDisk();
+void ejectHardDisk();
+int insertHardDisk(char *filename);
+
+
+//=========================================================== SUPER SERIAL CARD
+
+#define SSCROMSIZE 0x0800
+extern uint8_t sscRom[SSCROMSIZE];                                              // 2K of firmware in $C200 and $C800-$CFFF, if any
+
+struct acia {                                                                   // the 6551 in slot 2
+	uint8_t  data;                                                                // the byte received
+	uint8_t  status, command, control;                                            // its registers
+	unsigned long long int rxTick, txTick;                                        // the next byte can be received, is sent
+};
+
+extern THREADLOCAL struct acia acia;
+extern const struct card serialCard;
+
+int openSerial(const char *path);                                               // "pty" or a Unix socket, 0 on failure
+void closeSerial();
+const char *serialName();                                                       // the pty to open, or the socket
+
+
+//================================================================ BINARY FILES
+
+extern THREADLOCAL long runAddress;                                             // jumped to instead of booting, or -1
+
+long loadBinary(char *filename, long address);
+long loadSegment(char *argument);
+
+
+//================================================================ SAVE STATES
+
+struct snapshot {
+	uint8_t  *data;                                                               // reused from one save to the next
+	long     size;                                                                // bytes written, or to read
+	long     capacity;                                                            // bytes allocated
+	long     pos;                                                                 // read position
+	bool     error;                                                               // out of memory or truncated
+};
+
+int saveState(struct snapshot *s, bool full);
+int loadState(struct snapshot *s);
+int saveStateFile(char *filename);
+int loadStateFile(char *filename);
+
+
+//====================================================================== REWIND
+
+#define REWINDBUDGET 16                                                         // MB, by default
+#define REWINDFRAMES 6                                                          // between two snapshots, by default
+
+int historyInit(long megabytes, int frames);
+void historyCapture();
+int historyStep();
+
+
+//====================================================================== MOVIES
+
+enum movieMode { NOMOVIE, RECORDING, PLAYING };
+
+struct movie {
+	int      mode;
+	FILE     *file;                                                               // being recorded
+	uint8_t  *data;                                                               // being played, the whole file
+	long     size, pos;                                                           // and the next event in it
+	unsigned long long int next;                                                  // tick of the next event
+	uint8_t  KBD, PB0, PB1, PB2;                                                  // the inputs as the machine last saw them
+	float    GCP[2];
+	bool     hleDisk, fastLoad;
+};
+
+extern THREADLOCAL struct movie movie;
+
+void movieEvent(char type, const void *payload, int length);
+void movieInsert(char type, int drv, const char *filename);
+void movieMark();
+void movieInputs();
+void movieStop();
+int movieRecord(char *filename);
+int moviePlay(char *filename);
+void movieExec(unsigned long long int cycles);
+void movieMemory(uint16_t address, long length);
+
+
+//=================================================================== RUN-AHEAD
+
+#define RUNAHEADMAX 4                                                           // frames
+
+struct runAhead {
+	int      frames;                                                              // 0 : disabled
+	struct   snapshot state;                                                      // the real machine meanwhile, reused
+};
+
+extern THREADLOCAL struct runAhead runAhead;
+
+void runAheadStart();
+void runAheadStop();
+
+
+//======================================================================== RUNS
+
+struct run {                                                                    // how long to run the machine
+	unsigned long long int limit;                                                 // cycles, 0 : until the movie ends
+	char     *text;                                                               // to be shown on the text screen, or NULL
+	long     pc;                                                                  // address of the next instruction, or -1
+	long     memAddress;                                                          // memory to hold memValue, or -1
+	uint8_t  memValue;
+	bool     flush;                                                               // write the floppies back to their files
+};
+
+void resetMachine();
+int runMachine(struct run *r);
+
+
+//=================================================================== APPLESOFT
+
+bool basicPrompt();
+int loadBasic(const char *text, long length);
+char *listBasic();
+
+
+//======================================================================= VIDEO
+
+extern const int offsetGR[24];                                                  // TEXT and GR line addresses
+extern const int offsetHGR[192];                                                // HGR line addresses
+extern const int color[16][3];                                                  // the 16 low res colors
+extern const int hcolor[16][3];                                                 // the high res colors (2 light levels)
+
+#define TEXTSIZE (24 * 81 + 1)                                                  // the text screen, 80 columns at most
+
+uint8_t textGlyph(uint8_t value, bool flash, bool *reverse);                    // a text byte, as an index in the fonts
+uint8_t textByte(int line, int col, int columns);                               // of the text page displayed
+void screenText(char *text);
+
+#endif
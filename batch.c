@@ -0,0 +1,432 @@
+/*
+ * Reinette II plus, a french Apple II emulator
+ * the batch runner : a manifest of images and conditions, run unthrottled by
+ * a pool of threads, one machine per thread, for regression suites
+ * Copyright (c) 2020 Arthur Ferreira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#define _POSIX_C_SOURCE 200809L                                                 // clock_gettime and sysconf
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "apple2.h"
+
+
+#define DEFAULTLIMIT (60ULL * CPUFREQ)                                          // a minute, when only a condition is given
+#define MAXWORDS 64                                                             // per manifest line
+#define MAXSEGMENTS 16                                                          // binary files loaded
+#define MAXWORKERS 256
+
+void queueSound(bool level, unsigned int length) {}                             // nobody listens
+void floppyInserted(int drv) {}                                                 // no window title
+void floppyNotSaved(int drv) {}                                                 // floppies are never written back
+
+
+//======================================================================== JOBS
+
+enum outcome { PASS, FAIL, ERROR };
+
+struct job {
+	int      line;                                                                // in the manifest
+	char     *words[MAXWORDS];                                                    // the images, then the conditions
+	int      wordCount;
+	int      outcome;                                                             // PASS, FAIL or ERROR
+	char     error[200];                                                          // why it is an ERROR
+	unsigned long long int cycles;                                                // emulated
+	double   ms;                                                                  // wall time
+};
+
+struct job *jobs;
+int jobCount;
+
+
+static int splitWords(char *line, struct job *j) {                              // blanks separate, quotes group, \n
+	j->wordCount = 0;
+	char *src = line, *dst = line;
+	while (1) {
+		while (*src == ' ' || *src == '\t' || *src == '\r' || *src == '\n') src++;
+		if (!*src || *src == '#') return 1;                                         // a comment ends the line
+		if (j->wordCount == MAXWORDS) return 0;
+		j->words[j->wordCount++] = dst;
+		char quote = 0;
+		while (*src && (quote || (*src != ' ' && *src != '\t' && *src != '\r' && *src != '\n'))) {
+			if (quote ? *src == quote : *src == '"' || *src == '\'')
+				quote = quote ? 0 : *src;
+			else if (*src == '\\' && src[1]) {                                        // \n is a return, \" a quote
+				src++;
+				*dst++ = *src == 'n' ? '\n' : *src;
+			}
+			else
+				*dst++ = *src;
+			src++;
+		}
+		if (quote) return 0;                                                        // unterminated
+		if (*src) src++;
+		*dst++ = 0;                                                                 // dst never passes src
+	}
+}
+
+
+static int readManifest(char *filename) {
+	FILE *f = fopen(filename, "r");
+	if (!f) return 0;
+	char buffer[4096];
+	int capacity = 0;
+	for (int line = 1; fgets(buffer, sizeof(buffer), f); line++) {
+		struct job j = { line };
+		char *copy = strdup(buffer);
+		if (!copy || !splitWords(copy, &j)) {
+			fprintf(stderr, "%s:%d : too many words or a missing quote\n", filename, line);
+			fclose(f);
+			return 0;
+		}
+		if (!j.wordCount) {                                                         // blank or a comment
+			free(copy);
+			continue;
+		}
+		if (jobCount == capacity) {
+			capacity = capacity ? capacity * 2 : 64;
+			struct job *bigger = realloc(jobs, capacity * sizeof(struct job));
+			if (!bigger) {
+				fclose(f);
+				return 0;
+			}
+			jobs = bigger;
+		}
+		jobs[jobCount++] = j;
+	}
+	fclose(f);
+	return 1;
+}
+
+
+static double now() {                                                           // in ms
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1000.0 + t.tv_nsec / 1e6;
+}
+
+
+static void runJob(struct job *j) {                                             // on a fresh machine
+	double start = now();
+	struct run until = { 0, NULL, -1, -1, 0, false };
+	char *resume = NULL, *typed = NULL;                                           // once the cpu is reset
+	char *segments[MAXSEGMENTS];
+	int segmentCount = 0;
+	resetMachine();                                                               // the images of the last job are dropped unsaved
+	j->outcome = ERROR;
+
+	for (int i = 0, drv = 0; i < j->wordCount; i++) {
+		char **w = j->words;
+		bool value = i + 1 < j->wordCount;                                          // the option has its argument
+		if (!strcmp(w[i], "--cycles") && value)
+			until.limit = strtoull(w[++i], NULL, 0);
+		else if (!strcmp(w[i], "--frames") && value)
+			until.limit = strtoull(w[++i], NULL, 0) * FRAMECYCLES;
+		else if (!strcmp(w[i], "--until-text") && value)
+			until.text = w[++i];
+		else if (!strcmp(w[i], "--until-pc") && value)
+			until.pc = strtol(w[++i], NULL, 16) & 0xFFFF;
+		else if (!strcmp(w[i], "--until-mem") && value && strchr(w[i + 1], '=')) {
+			until.memAddress = strtol(w[++i], NULL, 16) & 0xFFFF;
+			until.memValue = strtol(strchr(w[i], '=') + 1, NULL, 16);
+		}
+		else if (!strcmp(w[i], "--hle"))
+			hleDisk = true;
+		else if (!strcmp(w[i], "--iie")) {
+			if (!setApple2e(true)) {
+				snprintf(j->error, sizeof(j->error), "the //e needs rom/appleIIe.rom (16 KB, $C000-$FFFF)");
+				return;
+			}
+		}
+		else if (!strcmp(w[i], "--videx")) {
+			if (!setVidex(true)) {
+				snprintf(j->error, sizeof(j->error), "the Videx needs rom/videx.rom (1 KB) and rom/videxFont.rom (2 KB)");
+				return;
+			}
+		}
+		else if (!strcmp(w[i], "--saturn") && value) {
+			if (!setLanguageCard(atoi(w[++i]))) {
+				snprintf(j->error, sizeof(j->error), "a Saturn card holds 16, 32, 64 or 128 KB");
+				return;
+			}
+		}
+		else if (!strcmp(w[i], "--type") && value)
+			typed = w[++i];
+		else if (!strcmp(w[i], "--load") && value && segmentCount < MAXSEGMENTS)
+			segments[segmentCount++] = w[++i];
+		else if (!strcmp(w[i], "--run") && value)
+			runAddress = strtol(w[i + 1] + (w[i + 1][0] == '$'), NULL, 16) & 0xFFFF, i++;
+		else if (w[i][0] == '-') {
+			snprintf(j->error, sizeof(j->error), "unknown option %s", w[i]);
+			return;
+		}
+		else if (hasExtension(w[i], ".state") || hasExtension(w[i], ".movie"))
+			resume = w[i];
+		else if (hasExtension(w[i], ".wav") ? !insertTape(w[i]) :
+		         !insertHardDisk(w[i]) && (drv >= DRIVES || !insertFloppy(w[i], drv++))) {
+			snprintf(j->error, sizeof(j->error), "%s could not be loaded", w[i]);
+			return;
+		}
+	}
+
+	pressReset();                                                                 // reset the 6502
+	ram[0x4D] = 0xAA;                                                             // as the SDL front end does
+	ram[0xD0] = 0xAA;
+
+	if (resume && hasExtension(resume, ".state") && !loadStateFile(resume)) {
+		snprintf(j->error, sizeof(j->error), "%s is not a valid state file", resume);
+		return;
+	}
+	if (resume && hasExtension(resume, ".movie") && !moviePlay(resume)) {
+		snprintf(j->error, sizeof(j->error), "%s is not a valid movie file", resume);
+		return;
+	}
+	for (int i = 0; i < segmentCount; i++)
+		if (loadSegment(segments[i]) < 0) {
+			snprintf(j->error, sizeof(j->error), "%s could not be loaded", segments[i]);
+			return;
+		}
+	if (typed && !typeText(typed, strlen(typed))) {
+		snprintf(j->error, sizeof(j->error), "not enough memory to type %s", typed);
+		return;
+	}
+
+	bool condition = until.text || until.pc >= 0 || until.memAddress >= 0;
+	if (!until.limit && !(movie.mode == PLAYING && !condition))                   // a movie runs to its end
+		until.limit = DEFAULTLIMIT;
+
+	unsigned long long int first = ticks;                                         // a state may not start at 0
+	bool met = runMachine(&until);
+	j->outcome = met || !condition ? PASS : FAIL;
+	j->cycles = ticks - first;
+	j->ms = now() - start;
+}
+
+
+//==================================================================== WORKERS
+// each worker takes its own jobs from the front of its deque, and once it is
+// empty steals from the back of the others : long jobs do not hold the end
+
+struct deque {
+	pthread_mutex_t lock;
+	int      *jobs;                                                               // indexes into jobs
+	int      head, tail;                                                          // [head, tail) is left to run
+};
+
+struct deque deques[MAXWORKERS];
+int workerCount;
+
+
+static int takeJob(int self) {                                                  // -1 once all the deques are empty
+	struct deque *d = &deques[self];
+	int job = -1;
+	pthread_mutex_lock(&d->lock);
+	if (d->head < d->tail) job = d->jobs[d->head++];
+	pthread_mutex_unlock(&d->lock);
+
+	for (int i = 1; job < 0 && i < workerCount; i++) {
+		d = &deques[(self + i) % workerCount];
+		pthread_mutex_lock(&d->lock);
+		if (d->head < d->tail) job = d->jobs[--d->tail];
+		pthread_mutex_unlock(&d->lock);
+	}
+	return job;
+}
+
+
+static void *worker(void *arg) {
+	int self = (int)(long)arg, job;
+	while ((job = takeJob(self)) >= 0)
+		runJob(&jobs[job]);
+	resetMachine();                                                               // frees this thread's images
+	return NULL;
+}
+
+
+//====================================================================== RESULTS
+
+static void printWord(const char *word) {                                       // as the manifest spells it
+	bool quoted = !*word || strpbrk(word, " \t'#") != NULL;
+	printf(quoted ? " \"" : " ");
+	for (const char *c = word; *c; c++) {
+		if (*c == '\n') printf("\\n");                                              // a return typed
+		else if (*c == '"' || *c == '\\') printf("\\%c", *c);
+		else putchar(*c);
+	}
+	if (quoted) putchar('"');
+}
+
+
+static void printResults(double wall) {
+	static const char *names[] = { "PASS ", "FAIL ", "ERROR" };
+	int count[3] = { 0 };
+	unsigned long long int cycles = 0;
+	for (int i = 0; i < jobCount; i++) {
+		struct job *j = &jobs[i];
+		count[j->outcome]++;
+		cycles += j->cycles;
+		printf("%s %12llu cycles %9.1f ms  line %d :", names[j->outcome], j->cycles, j->ms, j->line);
+		for (int w = 0; w < j->wordCount; w++)
+			printWord(j->words[w]);
+		if (j->outcome == ERROR) printf("  (%s)", j->error);
+		printf("\n");
+	}
+	printf("%d passed, %d failed, %d errors, %.1f s emulated in %.1f s on %d threads\n",
+	       count[PASS], count[FAIL], count[ERROR], (double)cycles / CPUFREQ, wall / 1000, workerCount);
+}
+
+
+static void usage() {
+	printf("usage : batch [-j THREADS] MANIFEST\n"
+	       "each line of the manifest is a job : the disks, tapes, hard disks, .state or\n"
+	       ".movie files, then its conditions, as headless takes them\n"
+	       "  --cycles N         run N cycles (a minute of emulated time by default)\n"
+	       "  --frames N         run N frames of 1/60 of a second\n"
+	       "  --until-text TEXT  pass as soon as TEXT shows on the text screen\n"
+	       "  --until-pc ADDR    pass when the cpu is about to execute ADDR (hex)\n"
+	       "  --until-mem ADDR=V pass when memory at ADDR holds V (hex)\n"
+	       "  --hle              fast DOS 3.3 disk accesses\n"
+	       "  --iie              an Apple //e, with 64 KB of aux memory and 80 columns\n"
+	       "  --videx            a Videx Videoterm in slot 3, shown while AN0 is on\n"
+	       "  --saturn KB        a Saturn card of 32, 64 or 128 KB in slot 0\n"
+	       "  --type TEXT        type TEXT, each key once the previous one was read\n"
+	       "  --load FILE[@ADDR] put a binary file in memory (hex address)\n"
+	       "  --run ADDR         jump to ADDR (hex) instead of booting\n"
+	       "quotes group words, \\n stands for a return, # starts a comment. A job\n"
+	       "without condition passes when its time is over. Exits with 0 when all the\n"
+	       "jobs pass, 1 otherwise, 2 on errors\n");
+}
+
+
+int main(int argc, char *argv[]) {
+
+
+	//================================================================== LOAD ROMS
+
+	char workDir[1000];                                                           // find the working directory
+	int workDirSize = 0, i = 0;
+	while (argv[0][i] != '\0' && i < 900) {
+		workDir[i] = argv[0][i];
+		if (argv[0][++i] == '\\' || argv[0][i] == '/') workDirSize = i + 1;         // find the last separator if any
+	}
+
+	workDir[workDirSize] = 0;
+	FILE *f = fopen(strcat(workDir, "rom/appleII+.rom"), "rb");                   // load the Apple II+ ROM
+	if (!f || fread(rom, 1, ROMSIZE, f) != ROMSIZE) {
+		fprintf(stderr, "appleII+.rom (12 KB) not found in the rom folder\n");
+		return 2;
+	}
+	fclose(f);
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/diskII.rom"), "rb");                           // load the P5A disk ][ PROM
+	if (!f || fread(sl6, 1, 256, f) != 256) {
+		fprintf(stderr, "diskII.rom (256 bytes) not found in the rom folder\n");
+		return 2;
+	}
+	fclose(f);
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/appleIIe.rom"), "rb");                         // the //e ROM, if any
+	if (f) {
+		if (fread(romIIe, 1, IIEROMSIZE, f) != IIEROMSIZE) memset(romIIe, 0, IIEROMSIZE);
+		fclose(f);
+	}
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/videx.rom"), "rb");                            // the Videx firmware and glyphs, if any
+	if (f) {
+		if (fread(videxRom, 1, VIDEXROMSIZE, f) != VIDEXROMSIZE) memset(videxRom, 0, VIDEXROMSIZE);
+		fclose(f);
+	}
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/videxFont.rom"), "rb");
+	if (f) {
+		if (fread(videxFont, 1, VIDEXFONTSIZE, f) != VIDEXFONTSIZE) memset(videxFont, 0, VIDEXFONTSIZE);
+		fclose(f);                                                                  // all are shared by the machines
+	}
+
+
+	//==================================================================== MANIFEST
+
+	char *manifest = NULL;
+	workerCount = sysconf(_SC_NPROCESSORS_ONLN);
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "-j") && i + 1 < argc)
+			workerCount = atoi(argv[++i]);
+		else if (argv[i][0] != '-' && !manifest)
+			manifest = argv[i];
+		else {
+			usage();
+			return 2;
+		}
+	}
+	if (!manifest) {
+		usage();
+		return 2;
+	}
+	if (!readManifest(manifest)) {
+		fprintf(stderr, "%s could not be read\n", manifest);
+		return 2;
+	}
+	if (workerCount > jobCount) workerCount = jobCount;
+	if (workerCount > MAXWORKERS) workerCount = MAXWORKERS;
+	if (workerCount < 1) workerCount = 1;
+
+
+	//===================================================================== THREADS
+
+	for (int w = 0; w < workerCount; w++) {                                       // deal the jobs round robin
+		deques[w].jobs = malloc((jobCount / workerCount + 1) * sizeof(int));
+		if (!deques[w].jobs) return 2;
+		pthread_mutex_init(&deques[w].lock, NULL);
+	}
+	for (int j = 0; j < jobCount; j++) {
+		struct deque *d = &deques[j % workerCount];
+		d->jobs[d->tail++] = j;
+	}
+
+	double start = now();
+	pthread_t threads[MAXWORKERS];
+	for (int w = 0; w < workerCount; w++)
+		if (pthread_create(&threads[w], NULL, worker, (void *)(long)w)) {
+			fprintf(stderr, "could not start the worker threads\n");
+			return 2;
+		}
+	for (int w = 0; w < workerCount; w++)
+		pthread_join(threads[w], NULL);
+
+	printResults(now() - start);
+
+	int status = 0;
+	for (int j = 0; j < jobCount; j++) {
+		if (jobs[j].outcome == ERROR) return 2;                                     // a job could not even run
+		if (jobs[j].outcome == FAIL) status = 1;
+	}
+	return status;
+}
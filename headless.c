@@ -0,0 +1,505 @@
+/*
+ * Reinette II plus, a french Apple II emulator
+ * the headless front end : no window, no sound, for scripts and batch hosts.
+ * It runs the machine for a while, or until a condition is met, then prints
+ * what was asked for and exits
+ * Copyright (c) 2020 Arthur Ferreira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apple2.h"
+
+
+#define DEFAULTLIMIT (60ULL * CPUFREQ)                                          // a minute, when only a condition is given
+#define MAXSEGMENTS 16                                                          // binary files loaded
+
+void queueSound(bool level, unsigned int length) {}                             // nobody listens
+void floppyInserted(int drv) {}                                                 // no window title
+void floppyNotSaved(int drv) {                                                  // --flush could not write it
+	fprintf(stderr, "drive %d could not be saved to %s\n", drv + 1, disk[drv].filename);
+}
+
+
+//=============================================================== FRAMEBUFFER
+// the same pixels as the SDL front end draws, 280 x 192 RGB, 560 x 192 when
+// the //e shows 80 columns or double high res, or 640 x 216 for the Videx
+// screen : its hash tells whether two runs ended on the same picture
+
+uint8_t frame[VIDEXROWS * VIDEXLINES][VIDEXCOLUMNS * 8][3];
+int frameWidth = 280, frameHeight = 192;                                        // the part in use
+uint8_t font[2][8][896][3];                                                     // normal and reverse, 128 glyphs of 7 x 8
+
+static int loadFont(const char *filename, int reverse) {                        // a 1 bit 896 x 8 BMP, as in assets
+	FILE *f = fopen(filename, "rb");
+	if (!f) return 0;
+	uint8_t bmp[1024];
+	long size = fread(bmp, 1, sizeof(bmp), f);
+	fclose(f);
+
+	long offset = bmp[10] | bmp[11] << 8 | bmp[12] << 16;
+	int width = bmp[18] | bmp[19] << 8, height = bmp[22] | bmp[23] << 8;
+	int stride = (width + 31) / 32 * 4;                                           // rows are 4 bytes aligned
+	if (size < 62 || memcmp(bmp, "BM", 2) || bmp[28] != 1 || width != 896 || height != 8 || offset + stride * 8 > size)
+		return 0;
+
+	for (int y = 0; y < 8; y++) {
+		const uint8_t *row = bmp + offset + (7 - y) * stride;                       // bottom-up
+		for (int x = 0; x < 896; x++) {
+			const uint8_t *bgr = bmp + 54 + ((row[x / 8] >> (7 - x % 8)) & 1) * 4;    // palette entry
+			for (int c = 0; c < 3; c++) font[reverse][y][x][c] = bgr[2 - c];
+		}
+	}
+	return 1;
+}
+
+static void setPixel(int x, int y, const int rgb[3]) {                          // one of 280, doubled in 560 columns
+	for (int i = 0; i < frameWidth / 280; i++)
+		for (int c = 0; c < 3; c++) frame[y][x * frameWidth / 280 + i][c] = rgb[c];
+}
+
+static void setDot(int x, int y, const int rgb[3]) {                            // one of 560
+	for (int c = 0; c < 3; c++) frame[y][x][c] = rgb[c];
+}
+
+static void drawGlyph(int col, int line, uint8_t glyph, bool reverse, int columns) {
+	int width = frameWidth / columns;                                             // 7, or 14 for 40 columns in 560
+	for (int y = 0; y < 8; y++)
+		for (int x = 0; x < width; x++)
+			memcpy(frame[line * 8 + y][col * width + x], font[reverse][y][glyph * 7 + x * 7 / width], 3);
+}
+
+static void renderVidex() {                                                     // white on black
+	for (int row = 0; row < VIDEXROWS; row++)
+		for (int line = 0; line < VIDEXLINES; line++)
+			for (int col = 0; col < VIDEXCOLUMNS; col++) {
+				uint8_t dots = videxDots(row, line, col);
+				for (int x = 0; x < 8; x++)
+					memset(frame[row * VIDEXLINES + line][col * 8 + x], dots & (0x80 >> x) ? 255 : 0, 3);
+			}
+}
+
+
+static void renderFrame() {
+	if (videxShown()) {
+		frameWidth = VIDEXCOLUMNS * 8;
+		frameHeight = VIDEXROWS * VIDEXLINES;
+		renderVidex();
+		return;
+	}
+	frameHeight = 192;
+	bool flash = (ticks / FRAMECYCLES) % 30 >= 15;                                // the SDL front end flashes every 15 frames
+	bool page2 = PAGE2 && !STORE80;                                               // with 80STORE, PAGE2 selects the //e memory
+	int columns = apple2e && COL80 ? 80 : 40;
+	bool dhgr = apple2e && COL80 && DHIRES && HIRES && !TEXT;
+	frameWidth = dhgr || (columns == 80 && (TEXT || MIXED)) ? 560 : 280;
+
+	if (dhgr) {                                                                   // DOUBLE HIGH RES GRAPHICS
+		uint16_t vRamBase = 0x2000 + page2 * 0x2000;
+		int lastLine = MIXED ? 160 : 192;
+		for (int line = 0; line < lastLine; line++) {
+			uint8_t bits[560];
+			for (int col = 0; col < 80; col++) {                                      // aux holds the even bytes
+				uint8_t byte = col & 1 ? ram[vRamBase + offsetHGR[line] + col / 2] : aux[vRamBase + offsetHGR[line] + col / 2];
+				for (int bit = 0; bit < 7; bit++) bits[col * 7 + bit] = (byte >> bit) & 1;
+			}
+			for (int x = 0; x < 560; x += 4) {                                        // 4 dots give a low res color
+				int c = bits[x] | bits[x + 1] << 1 | bits[x + 2] << 2 | bits[x + 3] << 3;
+				for (int i = 0; i < 4; i++) setDot(x + i, line, color[c]);
+			}
+		}
+	} else if (!TEXT && HIRES) {                                                  // HIGH RES GRAPHICS
+		uint16_t vRamBase = 0x2000 + page2 * 0x2000;
+		int lastLine = MIXED ? 160 : 192;
+		for (int line = 0; line < lastLine; line++) {
+			uint8_t pbit = 0;                                                         // the bit value of the left dot
+			for (int col = 0; col < 40; col++) {
+				uint8_t byte = ram[vRamBase + offsetHGR[line] + col];
+				int colorSet = (byte >> 7) * 4;
+				for (int bit = 0; bit < 7; bit++) {
+					int x = col * 7 + bit;
+					uint8_t b = (byte >> bit) & 1;
+					setPixel(x, line, hcolor[(x & 1 ? 8 : 0) + colorSet + (b << 1) + pbit]); // one pixel every two is darker
+					pbit = b;
+				}
+			}
+		}
+	} else if (!TEXT) {                                                           // LOW RES GRAPHICS
+		uint16_t vRamBase = 0x400 + page2 * 0x0400;
+		int lastLine = MIXED ? 20 : 24;
+		for (int line = 0; line < lastLine; line++)
+			for (int col = 0; col < 40; col++) {
+				uint8_t glyph = ram[vRamBase + offsetGR[line] + col];
+				for (int y = 0; y < 8; y++)
+					for (int x = 0; x < 7; x++)
+						setPixel(col * 7 + x, line * 8 + y, color[y < 4 ? glyph & 0x0F : glyph >> 4]);
+			}
+	}
+
+	if (TEXT || MIXED) {                                                          // TEXT 40 or 80 COLUMNS
+		for (int line = TEXT ? 0 : 20; line < 24; line++)
+			for (int col = 0; col < columns; col++) {
+				bool reverse;                                                           // INVERSE, or FLASH half of the time
+				uint8_t glyph = textGlyph(textByte(line, col, columns), flash, &reverse);
+				drawGlyph(col, line, glyph, reverse, columns);
+			}
+	}
+}
+
+static unsigned long long int frameHash() {                                     // FNV-1a, 64 bits
+	unsigned long long int hash = 14695981039346656037ULL;
+	for (int y = 0; y < frameHeight; y++) {
+		const uint8_t *p = &frame[y][0][0];
+		for (int i = 0; i < frameWidth * 3; i++)
+			hash = (hash ^ p[i]) * 1099511628211ULL;
+	}
+	return hash;
+}
+
+static int savePPM(const char *filename) {
+	FILE *f = fopen(filename, "wb");
+	if (!f) return 0;
+	fprintf(f, "P6\n%d %d\n255\n", frameWidth, frameHeight);
+	bool success = true;
+	for (int y = 0; y < frameHeight; y++)
+		if (fwrite(frame[y], 3, frameWidth, f) != frameWidth) success = false;
+	if (fclose(f)) success = false;
+	return success;
+}
+
+
+//==================================================================== APPLESOFT
+
+#define KEYIN 0xFD1B                                                            // the Monitor waits for a key
+
+static char *readText(const char *filename, long *length) {                     // the whole file, NULL if unreadable
+	FILE *f = fopen(filename, "rb");
+	if (!f) return NULL;
+	fseek(f, 0, SEEK_END);
+	*length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	char *text = *length >= 0 ? malloc(*length + 1) : NULL;
+	if (text && fread(text, 1, *length, f) != (size_t)*length) {
+		free(text);
+		text = NULL;
+	}
+	fclose(f);
+	return text;
+}
+
+
+static int waitPrompt(bool flush) {                                             // 0 if Applesoft never asked
+	unsigned long long int deadline = ticks + DEFAULTLIMIT;
+	while (getPC() != KEYIN || !basicPrompt()) {
+		if (ticks >= deadline) return 0;
+		struct run prompt = { deadline - ticks, NULL, KEYIN, -1, 0, flush };
+		movieExec(1);                                                               // off the last KEYIN
+		runMachine(&prompt);
+	}
+	return 1;
+}
+
+
+//========================================================== PROGRAM ENTRY POINT
+
+static void usage() {
+	printf("usage : headless [options] [disks, tapes, hard disks, .state or .movie files]\n"
+	       "  --cycles N         run N cycles (a minute of emulated time by default)\n"
+	       "  --frames N         run N frames of 1/60 of a second\n"
+	       "  --until-text TEXT  stop as soon as TEXT shows on the text screen\n"
+	       "  --until-pc ADDR    stop when the cpu is about to execute ADDR (hex)\n"
+	       "  --until-mem ADDR=V stop when memory at ADDR holds V (hex)\n"
+	       "  --hle              fast DOS 3.3 disk accesses\n"
+	       "  --iie              an Apple //e, with 64 KB of aux memory and 80 columns\n"
+	       "  --videx            a Videx Videoterm in slot 3, shown while AN0 is on\n"
+	       "  --serial PTY|SOCK  a Super Serial Card in slot 2, on a new pty (pty) or\n"
+	       "                     connected to a Unix socket\n"
+	       "  --saturn KB        a Saturn card of 32, 64 or 128 KB in slot 0, instead\n"
+	       "                     of the 16 KB language card\n"
+	       "  --type TEXT        type TEXT, each key once the previous one was read\n"
+	       "  --load FILE[@ADDR] put a binary file in memory, at ADDR (hex) or the\n"
+	       "                     address of its header (DOS 3.3, AppleSingle, #06AAAA)\n"
+	       "  --run ADDR         jump to ADDR (hex) instead of booting\n"
+	       "  --basic FILE       put this Applesoft listing in memory at the first\n"
+	       "                     prompt (before the text typed)\n"
+	       "  --save-disks       write the disks changes back to their images\n"
+	       "  --text             print the text screen\n"
+	       "  --list             print the Applesoft program in memory\n"
+	       "  --dump ADDR:LENGTH print memory (hex)\n"
+	       "  --hash             print the hash of the screen pixels\n"
+	       "  --ppm FILE         save the screen pixels\n"
+	       "  --save-state FILE  save the machine\n"
+	       "exits with 0 when a condition is met (or the run completes without any), 1\n"
+	       "if the time ran out first, 2 on errors\n");
+}
+
+
+int main(int argc, char *argv[]) {
+
+
+	//================================================================== LOAD ROMS
+
+	char workDir[1000];                                                           // find the working directory
+	int workDirSize = 0, i = 0;
+	while (argv[0][i] != '\0' && i < 900) {
+		workDir[i] = argv[0][i];
+		if (argv[0][++i] == '\\' || argv[0][i] == '/') workDirSize = i + 1;         // find the last separator if any
+	}
+
+	workDir[workDirSize] = 0;
+	FILE *f = fopen(strcat(workDir, "rom/appleII+.rom"), "rb");                   // load the Apple II+ ROM
+	if (!f || fread(rom, 1, ROMSIZE, f) != ROMSIZE) {
+		fprintf(stderr, "appleII+.rom (12 KB) not found in the rom folder\n");
+		return 2;
+	}
+	fclose(f);
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/diskII.rom"), "rb");                           // load the P5A disk ][ PROM
+	if (!f || fread(sl6, 1, 256, f) != 256) {
+		fprintf(stderr, "diskII.rom (256 bytes) not found in the rom folder\n");
+		return 2;
+	}
+	fclose(f);
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/appleIIe.rom"), "rb");                         // the //e ROM, if any
+	if (f) {
+		if (fread(romIIe, 1, IIEROMSIZE, f) != IIEROMSIZE) memset(romIIe, 0, IIEROMSIZE);
+		fclose(f);
+	}
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/videx.rom"), "rb");                            // the Videx firmware and glyphs, if any
+	if (f) {
+		if (fread(videxRom, 1, VIDEXROMSIZE, f) != VIDEXROMSIZE) memset(videxRom, 0, VIDEXROMSIZE);
+		fclose(f);
+	}
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/videxFont.rom"), "rb");
+	if (f) {
+		if (fread(videxFont, 1, VIDEXFONTSIZE, f) != VIDEXFONTSIZE) memset(videxFont, 0, VIDEXFONTSIZE);
+		fclose(f);
+	}
+
+	workDir[workDirSize] = 0;
+	f = fopen(strcat(workDir, "rom/ssc.rom"), "rb");                              // the Super Serial Card firmware, if any
+	if (f) {
+		if (fread(sscRom, 1, SSCROMSIZE, f) != SSCROMSIZE) memset(sscRom, 0, SSCROMSIZE);
+		fclose(f);
+	}
+
+
+	//========================================================== VM INITIALIZATION
+
+	resetMachine();                                                               // power on
+
+	struct run until = { 0, NULL, -1, -1, 0, false };
+	bool printText = false, printHash = false, printList = false;
+	char *ppm = NULL, *stateFile = NULL;
+	char *resume = NULL, *typed = NULL, *basic = NULL;                            // once the cpu is reset
+	char *segments[MAXSEGMENTS];
+	int segmentCount = 0;
+	long dumpAddress = -1, dumpLength = 0;
+
+	for (int i = 1, drv = 0; i < argc; i++) {
+		bool value = i + 1 < argc;                                                  // the option has its argument
+		if (!strcmp(argv[i], "--cycles") && value)
+			until.limit = strtoull(argv[++i], NULL, 0);
+		else if (!strcmp(argv[i], "--frames") && value)
+			until.limit = strtoull(argv[++i], NULL, 0) * FRAMECYCLES;
+		else if (!strcmp(argv[i], "--until-text") && value)
+			until.text = argv[++i];
+		else if (!strcmp(argv[i], "--until-pc") && value)
+			until.pc = strtol(argv[++i], NULL, 16) & 0xFFFF;
+		else if (!strcmp(argv[i], "--until-mem") && value && strchr(argv[i + 1], '=')) {
+			until.memAddress = strtol(argv[++i], NULL, 16) & 0xFFFF;
+			until.memValue = strtol(strchr(argv[i], '=') + 1, NULL, 16);
+		}
+		else if (!strcmp(argv[i], "--hle"))
+			hleDisk = true;
+		else if (!strcmp(argv[i], "--iie")) {
+			if (!setApple2e(true)) {
+				fprintf(stderr, "the //e needs rom/appleIIe.rom (16 KB, $C000-$FFFF)\n");
+				return 2;
+			}
+		}
+		else if (!strcmp(argv[i], "--videx")) {
+			if (!setVidex(true)) {
+				fprintf(stderr, "the Videx needs rom/videx.rom (1 KB) and rom/videxFont.rom (2 KB)\n");
+				return 2;
+			}
+		}
+		else if (!strcmp(argv[i], "--serial") && value) {
+			if (!openSerial(argv[++i])) {
+				fprintf(stderr, "%s could not be opened for the serial card\n", argv[i]);
+				return 2;
+			}
+			fprintf(stderr, "serial card on %s\n", serialName());                     // the pty to open
+		}
+		else if (!strcmp(argv[i], "--saturn") && value) {
+			if (!setLanguageCard(atoi(argv[++i]))) {
+				fprintf(stderr, "a Saturn card holds 16, 32, 64 or 128 KB\n");
+				return 2;
+			}
+		}
+		else if (!strcmp(argv[i], "--type") && value)
+			typed = argv[++i];
+		else if (!strcmp(argv[i], "--basic") && value)
+			basic = argv[++i];
+		else if (!strcmp(argv[i], "--load") && value && segmentCount < MAXSEGMENTS)
+			segments[segmentCount++] = argv[++i];
+		else if (!strcmp(argv[i], "--run") && value)
+			runAddress = strtol(argv[i + 1] + (argv[i + 1][0] == '$'), NULL, 16) & 0xFFFF, i++;
+		else if (!strcmp(argv[i], "--save-disks"))
+			until.flush = true;
+		else if (!strcmp(argv[i], "--text"))
+			printText = true;
+		else if (!strcmp(argv[i], "--list"))
+			printList = true;
+		else if (!strcmp(argv[i], "--dump") && value && strchr(argv[i + 1], ':')) {
+			dumpAddress = strtol(argv[++i], NULL, 16) & 0xFFFF;
+			dumpLength = strtol(strchr(argv[i], ':') + 1, NULL, 16);
+		}
+		else if (!strcmp(argv[i], "--hash"))
+			printHash = true;
+		else if (!strcmp(argv[i], "--ppm") && value)
+			ppm = argv[++i];
+		else if (!strcmp(argv[i], "--save-state") && value)
+			stateFile = argv[++i];
+		else if (argv[i][0] == '-') {
+			usage();
+			return 2;
+		}
+		else if (hasExtension(argv[i], ".state") || hasExtension(argv[i], ".movie"))
+			resume = argv[i];
+		else if (hasExtension(argv[i], ".wav") ? !insertTape(argv[i]) :
+		         !insertHardDisk(argv[i]) && (drv >= DRIVES || !insertFloppy(argv[i], drv++))) {
+			fprintf(stderr, "%s could not be loaded\n", argv[i]);
+			return 2;
+		}
+	}
+
+	pressReset();                                                                 // reset the 6502
+	ram[0x4D] = 0xAA;                                                             // as the SDL front end does
+	ram[0xD0] = 0xAA;
+
+	if (resume && hasExtension(resume, ".state") && !loadStateFile(resume)) {     // or resume a saved session
+		fprintf(stderr, "%s is not a valid state file\n", resume);
+		return 2;
+	}
+	if (resume && hasExtension(resume, ".movie") && !moviePlay(resume)) {
+		fprintf(stderr, "%s is not a valid movie file\n", resume);
+		return 2;
+	}
+	for (int i = 0; i < segmentCount; i++)                                        // in the order given
+		if (loadSegment(segments[i]) < 0) {
+			fprintf(stderr, "%s could not be loaded (no address, or over $C000-$CFFF)\n", segments[i]);
+			return 2;
+		}
+	if (basic) {
+		long length;
+		char *text = readText(basic, &length);
+		if (!text) {
+			fprintf(stderr, "%s could not be read\n", basic);
+			return 2;
+		}
+		if (!waitPrompt(until.flush)) {
+			fprintf(stderr, "Applesoft did not wait for a command\n");
+			return 2;
+		}
+		if (!loadBasic(text, length)) {
+			fprintf(stderr, "%s is not an Applesoft listing, or doesn't fit\n", basic);
+			return 2;
+		}
+		free(text);
+	}
+	if (typed && !typeText(typed, strlen(typed))) {
+		fprintf(stderr, "not enough memory to type %s\n", typed);
+		return 2;
+	}
+
+	bool condition = until.text || until.pc >= 0 || until.memAddress >= 0;
+	if (!until.limit && !(movie.mode == PLAYING && !condition))                   // a movie runs to its end
+		until.limit = DEFAULTLIMIT;
+
+
+	//================================================================== MAIN LOOP
+
+	bool met = runMachine(&until);
+	movieStop();
+
+
+	//===================================================================== RESULTS
+
+	if (printText) {
+		char text[TEXTSIZE];
+		screenText(text);
+		fputs(text, stdout);
+	}
+	if (printList) {
+		char *text = listBasic();
+		if (text) fputs(text, stdout);
+		free(text);
+	}
+	for (long a = 0; a < dumpLength; a += 16) {
+		printf("%04lX:", (dumpAddress + a) & 0xFFFF);
+		for (long b = a; b < a + 16 && b < dumpLength; b++)
+			printf(" %02X", peek((dumpAddress + b) & 0xFFFF));
+		printf("\n");
+	}
+	if (printHash || ppm) {
+		workDir[workDirSize] = 0;
+		bool fonts = loadFont(strcat(workDir, "assets/font-normal.bmp"), 0);
+		workDir[workDirSize] = 0;
+		fonts = loadFont(strcat(workDir, "assets/font-reverse.bmp"), 1) && fonts;
+		if (!fonts) {
+			fprintf(stderr, "the fonts were not found in the assets folder\n");
+			return 2;
+		}
+		renderFrame();
+		if (printHash) printf("%016llx\n", frameHash());
+		if (ppm && !savePPM(ppm)) {
+			fprintf(stderr, "could not write %s\n", ppm);
+			return 2;
+		}
+	}
+	if (stateFile && !saveStateFile(stateFile)) {
+		fprintf(stderr, "could not write %s\n", stateFile);
+		return 2;
+	}
+	if (until.flush) {                                                            // the changes are dropped otherwise
+		for (int drv = 0; drv < DRIVES; drv++)
+			if (disk[drv].filename[0] && !disk[drv].readOnly && !saveFloppy(drv)) {
+				fprintf(stderr, "%s could not be written\n", disk[drv].filename);
+				return 2;
+			}
+		if (hdd.image && !hdd.readOnly && !saveHardDisk()) {                        // its writes are kept in memory until now
+			fprintf(stderr, "%s could not be written\n", hdd.filename);
+			return 2;
+		}
+	}
+
+	return condition && !met;
+}
@@ -60,12 +60,12 @@
 #endif
 
 
-unsigned long long int ticks = 0;  // accumulated number of clock cycles
+THREADLOCAL unsigned long long int ticks = 0;  // accumulated number of clock cycles
 
 
-static uint16_t PC;  //  Program Counter
-static uint8_t A, X, Y, SP;  // Accumulator, X and y indexes and Stack Pointer
-static union {
+static THREADLOCAL uint16_t PC;  //  Program Counter
+static THREADLOCAL uint8_t A, X, Y, SP;  // Accumulator, X and y indexes and Stack Pointer
+static THREADLOCAL union {
 	uint8_t byte;
   struct {
     uint8_t C : 1;  // Carry
@@ -89,29 +89,27 @@ void puce6502RST() {  // Reset
 
 
 void puce6502IRQ() {  // Interupt Request
-	if (!P.I) return;
-	P.I = 1;
-	PC++;
-	writeMem(0x100 + SP, (PC >> 8) & 0xFF);
+	if (P.I) return;  // masked
+	writeMem(0x100 + SP, (PC >> 8) & 0xFF);  // the address of the next instruction
 	SP--;
 	writeMem(0x100 + SP, PC & 0xFF);
 	SP--;
-	writeMem(0x100 + SP, P.byte & ~BREAK);
+	writeMem(0x100 + SP, P.byte & ~BREAK);  // with I as it was, for RTI
 	SP--;
+	P.I = 1;
 	PC = readMem(0xFFFE) | (readMem(0xFFFF) << 8);
 	ticks += 7;
 }
 
 
 void puce6502NMI() {  // Non Maskable Interupt
-	P.I = 1;
-	PC++;
-	writeMem(0x100 + SP, (PC >> 8) & 0xFF);
+	writeMem(0x100 + SP, (PC >> 8) & 0xFF);  // the address of the next instruction
 	SP--;
 	writeMem(0x100 + SP, PC & 0xFF);
 	SP--;
-	writeMem(0x100 + SP, P.byte & ~BREAK);
+	writeMem(0x100 + SP, P.byte & ~BREAK);  // with I as it was, for RTI
 	SP--;
+	P.I = 1;
 	PC = readMem(0xFFFA) | (readMem(0xFFFB) << 8);
 	ticks += 7;
 }
@@ -1903,6 +1901,24 @@ uint16_t getPC(){
 	return PC;
 }
 
+void puce6502GetRegs(puce6502Regs *regs) {
+	regs->PC = PC;
+	regs->A = A;
+	regs->X = X;
+	regs->Y = Y;
+	regs->SP = SP;
+	regs->P = P.byte;
+}
+
+void puce6502SetRegs(const puce6502Regs *regs) {
+	PC = regs->PC;
+	A = regs->A;
+	X = regs->X;
+	Y = regs->Y;
+	SP = regs->SP;
+	P.byte = regs->P;
+}
+
 
 
 #if _FUNCTIONNAL_TESTS
@@ -36,7 +36,18 @@ typedef unsigned char uint8_t;
 typedef unsigned short uint16_t;
 typedef enum { false, true } bool;
 
-extern unsigned long long int ticks;
+#ifdef THREADED                 // one machine per thread : its state is thread local
+#define THREADLOCAL _Thread_local
+#else
+#define THREADLOCAL
+#endif
+
+extern THREADLOCAL unsigned long long int ticks;
+
+typedef struct {
+	uint16_t PC;
+	uint8_t A, X, Y, SP, P;
+} puce6502Regs;
 
 uint16_t puce6502Exec(unsigned long long int cycleCount);
 void puce6502RST();
@@ -45,7 +56,9 @@ void puce6502NMI();
 
 // void printRegs();
 // void dasm(uint16_t address);
-// void setPC(uint16_t address);
-// uint16_t getPC();
+void setPC(uint16_t address);
+uint16_t getPC();
+void puce6502GetRegs(puce6502Regs *regs);
+void puce6502SetRegs(const puce6502Regs *regs);
 
 #endif
@@ -25,72 +25,39 @@
 
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <SDL2/SDL.h>
 
-#include "puce6502.h"
+#include "apple2.h"
 
 
-// memory layout
-#define RAMSIZE  0xC000
-#define ROMSTART 0xD000
-#define ROMSIZE  0x3000
-uint8_t ram[RAMSIZE];   // 48K of ram in $000-$BFFF
-uint8_t rom[ROMSIZE];   // 12K of rom in $D000-$FFFF
+#define WARPTIME 12                                                             // ms of emulation per frame while a disk spins
+#define WARPMAX  64                                                             // fastest multiplier, then unthrottled
 
-// language card
-#define LGCSTART 0xD000
-#define LGCSIZE  0x3000
-#define BK2START 0xD000
-#define BK2SIZE  0x1000
-uint8_t lgc[LGCSIZE];   // Language Card 12K in $D000-$FFFF
-uint8_t bk2[BK2SIZE];   // bank 2 of Language Card 4K in $D000-$DFFF
+SDL_Window *wdo;                                                                // the window, its title lists the floppies
 
-// disk ][ prom
-#define SL6START 0xC600
-#define SL6SIZE  0x0100
-uint8_t sl6[SL6SIZE];   // P5A disk ][ prom in slot 6
-
-
-//================================================================ SOFT SWITCHES
-
-uint8_t KBD   = 0;                                                              // $C000, $C010 ascii value of keyboard input
-bool TEXT  = true;                                                              // $C050 CLRTEXT  / $C051 SETTEXT
-bool MIXED = false;                                                             // $C052 CLRMIXED / $C053 SETMIXED
-bool PAGE2 = false;                                                             // $C054 PAGE2 off / $C055 PAGE2 on
-bool HIRES = false;                                                             // $C056 GR       / $C057 HGR
-bool LCWR  = true;                                                              // Language Card writable
-bool LCRD  = false;                                                             // Language Card readable
-bool LCBK2 = true;                                                              // Language Card bank 2 enabled
-bool LCWFF = false;                                                             // Language Card pre-write flip flop
-
-
-//====================================================================== PADDLES
-
-uint8_t PB0 = 0;                                                                // $C061 Push Button 0 (bit 7) / Open Apple
-uint8_t PB1 = 0;                                                                // $C062 Push Button 1 (bit 7) / Solid Apple
-uint8_t PB2 = 0;                                                                // $C063 Push Button 2 (bit 7) / shift mod !!!
-float GCP[2] = { 127.0f, 127.0f };                                              // GC Position ranging from 0 (left) to 255 right
-float GCC[2] = { 0.0f };                                                        // $C064 (GC0) and $C065 (GC1) Countdowns
-int GCD[2] = { 0 };                                                             // GC0 and GC1 Directions (left/down or right/up)
-int GCA[2] = { 0 };                                                             // GC0 and GC1 Action (push or release)
 uint8_t GCActionSpeed = 8;                                                      // Game Controller speed at which it goes to the edges
 uint8_t GCReleaseSpeed = 8;                                                     // Game Controller speed at which it returns to center
-long long int GCCrigger;                                                        // $C070 the tick at which the GCs were reseted
 
-inline static void resetPaddles() {
-	GCC[0] = GCP[0] * GCP[0];                                                     // initialize the countdown for both paddles
-	GCC[1] = GCP[1] * GCP[1];                                                     // to the square of their actuall values (positions)
-	GCCrigger = ticks;                                                            // records the time this was done
-}
+int warpSpeed = 1;                                                              // frames run per host frame, 0 : unthrottled
+int warpChoice = 8;                                                             // the speed F9 toggles to
 
-inline static uint8_t readPaddle(int pdl) {
-	const float GCFreq = 6.6;                                                     // the speed at which the GC values decrease
 
-	GCC[pdl] -= (ticks - GCCrigger) / GCFreq;                                     // decreases the countdown
-	if (GCC[pdl] <= 0)                                                            // timeout
-		return GCC[pdl] = 0;                                                        // returns 0
-	return 0x80;                                                                  // not timeout, return something with the MSB set
+//====================================================================== PADDLES
+
+void movePaddles(int frames) {                                                  // they follow the emulated time
+	for (int pdl = 0; pdl < 2; pdl++) {                                           // update the two paddles positions
+		if (GCA[pdl]) {                                                             // actively pushing the stick
+			GCP[pdl] += GCD[pdl] * GCActionSpeed * frames;
+			if (GCP[pdl] > 255) GCP[pdl] = 255;
+			if (GCP[pdl] < 0)   GCP[pdl] = 0;
+		} else {                                                                    // the stick is return back to center
+			GCP[pdl] += GCD[pdl] * GCReleaseSpeed * frames;
+			if (GCD[pdl] == 1  && GCP[pdl] > 127) GCP[pdl] = 127;
+			if (GCD[pdl] == -1 && GCP[pdl] < 127) GCP[pdl] = 127;
+		}
+	}
 }
 
 
@@ -101,253 +68,39 @@ Sint8 audioBuffer[2][audioBufferSize] = { 0 };
 SDL_AudioDeviceID audioDevice;
 bool muted = false;                                                             // mute/unmute switch
 
-static void playSound() {
-	static long long int lastTick = 0LL;
-	static bool SPKR = false;                                                     // $C030 Speaker toggle
-
-	if (!muted) {
-		SPKR = !SPKR;                                                               // toggle speaker state
-		Uint32 length = (int)((double)(ticks - lastTick) / 10.65625f);              // 1023000Hz / 96000Hz = 10.65625
-		lastTick = ticks;
-		if (length > audioBufferSize) length = audioBufferSize;
-		SDL_QueueAudio(audioDevice, audioBuffer[SPKR], length | 1);                 // | 1 TO HEAR HIGH FREQ SOUNDS
-	}
+void queueSound(bool level, unsigned int length) {                              // called by the machine on $C030
+	if (muted) return;
+	if (length > audioBufferSize) length = audioBufferSize;
+	SDL_QueueAudio(audioDevice, audioBuffer[level], length | 1);                  // | 1 TO HEAR HIGH FREQ SOUNDS
 }
 
 
-//====================================================================== DISK ][
-
-int curDrv = 0;                                                                 // Current Drive - only one can be enabled at a time
-
-struct drive {
-	char		 filename[400];                                                       // the full disk image pathname
-	bool		 readOnly;                                                            // based on the image file attributes
-	uint8_t	 data[232960];                                                        // nibblelized disk image
-	bool		 motorOn;                                                             // motor status
-	bool		 writeMode;                                                           // writes to file are not implemented
-	uint8_t	 track;                                                               // current track position
-	uint16_t nibble;                                                              // ptr to nibble under head position
-} disk[2] = { 0 };                                                              // two disk ][ drive units
-
+//================================================================ WINDOW TITLE
 
-int insertFloppy(SDL_Window *wdo, char *filename, int drv) {
-
-	FILE *f = fopen(filename, "rb");                                              // open file in read binary mode
-	if (!f || fread(disk[drv].data, 1, 232960, f) != 232960)                      // load it into memory and check size
-		return 0;
-	fclose(f);
-
-	sprintf(disk[drv].filename, "%s", filename);                                  // update disk filename record
-
-	f = fopen(filename, "ab");                                                    // try to open the file in append binary mode
-	if (f) {                                                                      // success, file is writable
-		disk[drv].readOnly = false;                                                 // update the readOnly flag
-		fclose(f);                                                                  // and close it untouched
-	} else {
-		disk[drv].readOnly = true;                                                  // f is NULL, no writable, no need to close it
+void updateTitle() {                                                            // the floppies, and the speed
+	char title[1000] = "Reinette ][+";
+	for (int d = 0; d < DRIVES; d++) {
+		if (!diskII[d / 2].enabled) continue;
+		int i = 0, a = 0;
+		while (disk[d].filename[i] != 0)                                            // find start of filename
+			if (disk[d].filename[i++] == '\\') a = i;
+		sprintf(title + strlen(title), d < 2 ? "   D%d: %s" : "   S5D%d: %s", d % 2 + 1, disk[d].filename + a);
 	}
-	char title[1000];                                                             // UPDATE WINDOW TITLE
-	int i, a, b;
-
-	i = a = 0;
-	while (disk[0].filename[i] != 0)                                              // find start of filename for disk0
-		if (disk[0].filename[i++] == '\\') a = i;
-	i = b = 0;
-	while (disk[1].filename[i] != 0)                                              // find start of filename for disk1
-		if (disk[1].filename[i++] == '\\') b = i;
-
-	sprintf(title, "Reinette ][+   D1: %s   D2: %s", disk[0].filename + a, disk[1].filename + b);
+	if (warpSpeed > 1) sprintf(title + strlen(title), "   warp x%d", warpSpeed);
+	if (warpSpeed == 0) strcat(title, "   warp");
 	SDL_SetWindowTitle(wdo, title);                                               // updates window title
-
-	return 1;
-}
-
-
-int saveFloppy(int drive) {
-	if (!disk[drive].filename[0]) return 0;                                       // no file loaded into drive
-	if (disk[drive].readOnly) return 0;                                           // file is read only write no aptempted
-
-	FILE *f = fopen(disk[drive].filename, "wb");
-	if (!f) return 0;                                                             // could not open the file in write overide binary
-
-	if (fwrite(disk[drive].data, 1, 232960, f) != 232960) {                       // failed to write the full file (disk full ?)
-		fclose(f);                                                                  // release the ressource
-		return 0;
-	}
-	fclose(f);                                                                    // success, release the ressource
-	return 1;
-}
-
-
-void stepMotor(uint16_t address) {
-	static bool phases[2][4] = { 0 };                                             // phases states (for both drives)
-	static bool phasesB[2][4] = { 0 };                                            // phases states Before
-	static bool phasesBB[2][4] = { 0 };                                           // phases states Before Before
-	static int pIdx[2] = { 0 };                                                   // phase index (for both drives)
-	static int pIdxB[2] = { 0 };                                                  // phase index Before
-	static int halfTrackPos[2] = { 0 };
-
-	address &= 7;
-	int phase = address >> 1;
-
-	phasesBB[curDrv][pIdxB[curDrv]] = phasesB[curDrv][pIdxB[curDrv]];
-	phasesB[curDrv][pIdx[curDrv]]   = phases[curDrv][pIdx[curDrv]];
-	pIdxB[curDrv] = pIdx[curDrv];
-	pIdx[curDrv]  = phase;
-
-	if (!(address & 1)) {                                                         // head not moving (PHASE x OFF)
-		phases[curDrv][phase] = false;
-		return;
-	}
-
-	if ((phasesBB[curDrv][(phase + 1) & 3]) && (--halfTrackPos[curDrv] < 0))      // head is moving in
-		halfTrackPos[curDrv] = 0;
-
-	if ((phasesBB[curDrv][(phase - 1) & 3]) && (++halfTrackPos[curDrv] > 140))    // head is moving out
-		halfTrackPos[curDrv] = 140;
-
-	phases[curDrv][phase] = true;                                                 // update track#
-	disk[curDrv].track = (halfTrackPos[curDrv] + 1) / 2;
 }
 
 
-inline void setDrv(int drv) {
-	disk[drv].motorOn = disk[!drv].motorOn || disk[drv].motorOn;                  // if any of the motors were ON
-	disk[!drv].motorOn = false;                                                   // motor of the other drive is set to OFF
-	curDrv = drv;                                                                 // set the current drive
+void floppyInserted(int drv) {                                                  // called by the machine
+	updateTitle();
 }
 
 
-//========================================== MEMORY MAPPED SOFT SWITCHES HANDLER
-// this function is called from readMem and writeMem
-// it complements both functions when address is in page $C0
-uint8_t softSwitches(uint16_t address, uint8_t value, bool WRT) {
-	static uint8_t dLatch = 0;                                                    // disk ][ I/O register
-
-	switch (address) {
-  	case 0xC000: return KBD;                                                    // KEYBOARD
-  	case 0xC010: KBD &= 0x7F; return KBD;                                       // KBDSTROBE
-
-  	case 0xC020:                                                                // TAPEOUT (shall we listen it ? - try SAVE from applesoft)
-  	case 0xC030:                                                                // SPEAKER
-  	case 0xC033: playSound(); break;                                            // apple invader uses $C033 to output sound !
-
-  	case 0xC050: TEXT  = false; break;                                          // Graphics
-  	case 0xC051: TEXT  = true;  break;                                          // Text
-  	case 0xC052: MIXED = false; break;                                          // Mixed off
-  	case 0xC053: MIXED = true;  break;                                          // Mixed on
-  	case 0xC054: PAGE2 = false; break;                                          // PAGE2 off
-  	case 0xC055: PAGE2 = true;  break;                                          // PAGE2 on
-  	case 0xC056: HIRES = false; break;                                          // HiRes off
-  	case 0xC057: HIRES = true;  break;                                          // HiRes on
-
-  	case 0xC061: return PB0;                                                    // Push Button 0
-  	case 0xC062: return PB1;                                                    // Push Button 1
-  	case 0xC063: return PB2;                                                    // Push Button 2
-  	case 0xC064: return readPaddle(0);                                          // Paddle 0
-  	case 0xC065: return readPaddle(1);                                          // Paddle 1
-
-  	case 0xC070: resetPaddles(); break;                                         // paddle timer RST
-
-    case 0xC080:                                                                // LANGUAGE CARD :
-  	case 0xC084: LCBK2 = 1; LCRD = 1; LCWR = 0;      LCWFF = 0;    break;       // LC2RD
-  	case 0xC081:
-  	case 0xC085: LCBK2 = 1; LCRD = 0; LCWR |= LCWFF; LCWFF = !WRT; break;       // LC2WR
-  	case 0xC082:
-  	case 0xC086: LCBK2 = 1; LCRD = 0; LCWR = 0;      LCWFF = 0;    break;       // ROMONLY2
-  	case 0xC083:
-  	case 0xC087: LCBK2 = 1; LCRD = 1; LCWR |= LCWFF; LCWFF = !WRT; break;       // LC2RW
-  	case 0xC088:
-  	case 0xC08C: LCBK2 = 0; LCRD = 1; LCWR = 0;      LCWFF = 0;    break;       // LC1RD
-  	case 0xC089:
-  	case 0xC08D: LCBK2 = 0; LCRD = 0; LCWR |= LCWFF; LCWFF = !WRT; break;       // LC1WR
-  	case 0xC08A:
-  	case 0xC08E: LCBK2 = 0; LCRD = 0; LCWR = 0;      LCWFF = 0;    break;       // ROMONLY1
-  	case 0xC08B:
-  	case 0xC08F: LCBK2 = 0; LCRD = 1; LCWR |= LCWFF; LCWFF = !WRT; break;       // LC1RW
-
-		case 0xC0E0:
-		case 0xC0E1:
-		case 0xC0E2:
-		case 0xC0E3:
-		case 0xC0E4:
-    case 0xC0E5:
-		case 0xC0E6:
-		case 0xC0E7: stepMotor(address); break;                                     // MOVE DRIVE HEAD
-
-  	case 0xCFFF:
-  	case 0xC0E8: disk[curDrv].motorOn = false; break;                           // MOTOROFF
-  	case 0xC0E9: disk[curDrv].motorOn = true;  break;                           // MOTORON
-
-  	case 0xC0EA: setDrv(0); break;                                              // DRIVE0EN
-  	case 0xC0EB: setDrv(1); break;                                              // DRIVE1EN
-
-  	case 0xC0EC:                                                                // Shift Data Latch
-  		if (disk[curDrv].writeMode)                                               // writting
-  			disk[curDrv].data[disk[curDrv].track*0x1A00+disk[curDrv].nibble]=dLatch;// good luck gcc
-  		else                                                                      // reading
-  			dLatch=disk[curDrv].data[disk[curDrv].track*0x1A00+disk[curDrv].nibble];// easy peasy
-  		disk[curDrv].nibble = (disk[curDrv].nibble + 1) % 0x1A00;                 // turn floppy of 1 nibble
-  		return dLatch;
-
-  	case 0xC0ED: dLatch = value; break;                                         // Load Data Latch
-
-  	case 0xC0EE:                                                                // latch for READ
-  		disk[curDrv].writeMode = false;
-  		return disk[curDrv].readOnly ? 0x80 : 0;                                  // check protection
-
-  	case 0xC0EF: disk[curDrv].writeMode = true; break;                          // latch for WRITE
-	}
-	return ticks % 0xFF;                                                          // catch all, gives a 'floating' value
-}
-
-
-//======================================================================= MEMORY
-// these two functions are imported into puce6502.c
-
-uint8_t readMem(uint16_t address) {
-	if (address < RAMSIZE)
-		return ram[address];                                                        // RAM
-
-	if (address >= ROMSTART) {
-		if (!LCRD)
-			return rom[address - ROMSTART];                                           // ROM
-
-		if (LCBK2 && (address < 0xE000))
-			return bk2[address - BK2START];                                           // BK2
-
-		return lgc[address - LGCSTART];                                             // LC
-	}
-
-	if ((address & 0xFF00) == SL6START)
-		return sl6[address - SL6START];                                             // disk][
-
-	if ((address & 0xF000) == 0xC000)
-		return softSwitches(address, 0, false);                                     // Soft Switches
-
-	return ticks & 0xFF;                                                          // catch all, gives a 'floating' value
-}
-
-
-void writeMem(uint16_t address, uint8_t value) {
-	if (address < RAMSIZE) {
-		ram[address] = value;                                                       // RAM
-		return;
-	}
-
-	if (LCWR && (address >= ROMSTART)) {
-		if (LCBK2 && (address < 0xE000)) {
-			bk2[address - BK2START] = value;                                          // BK2
-			return;
-		}
-		lgc[address - LGCSTART] = value;                                            // LC
-		return;
-	}
-
-	if ((address & 0xF000) == 0xC000) {
-		softSwitches(address, value, true);                                         // Soft Switches
-		return;
-	}
+void floppyNotSaved(int drv) {                                                  // when the motor stopped
+	char msg[460];
+	snprintf(msg, sizeof(msg), "\n%s %d could not be saved to\n%s\n", drv < 2 ? "Disk" : "Slot 5 disk", drv % 2 + 1, disk[drv].filename);
+	SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_WARNING, "Save", msg, NULL);
 }
 
 
@@ -359,16 +112,16 @@ int main(int argc, char *argv[]) {
 	//========================================================= SDL INITIALIZATION
 
 	int zoom = 2;
-	uint8_t tries = 0;                                                            // for disk ][ speed-up access
 	SDL_Event event;
 	SDL_bool running = true, paused = false, ctrl = false, shift = false, alt = false;
+	SDL_bool rewinding = false;                                                   // shift F10 is held
 
 	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
 		printf("failed to initialize SDL2 : %s", SDL_GetError());
 		return -1;
 	}
 
-	SDL_Window *wdo = SDL_CreateWindow("Reinette ][+", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 280 * zoom, 192 * zoom, SDL_WINDOW_OPENGL);
+	wdo = SDL_CreateWindow("Reinette ][+", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, 280 * zoom, 192 * zoom, SDL_WINDOW_OPENGL);
 	SDL_Renderer *rdr = SDL_CreateRenderer(wdo, -1, SDL_RENDERER_ACCELERATED | SDL_RENDERER_PRESENTVSYNC);
 	SDL_SetRenderDrawBlendMode(rdr, SDL_BLENDMODE_NONE);                          // SDL_BLENDMODE_BLEND);
 	SDL_EventState(SDL_DROPFILE, SDL_ENABLE);                                     // ask SDL2 to read dropfile events
@@ -396,10 +149,12 @@ int main(int argc, char *argv[]) {
 	int HiResCache[192][40] = { 0 };                                              // check which Hi-Res 7 dots needs redraw
 	uint8_t previousBit[192][40] = { 0 };                                         // the last bit value of the byte before.
 
-	enum characterAttribute { A_NORMAL, A_INVERSE, A_FLASH } glyphAttr;           // character attribute in TEXT
-	uint8_t flashCycle = 0;                                                       // TEXT cursor flashes at 2Hz
+	uint8_t flashCycle = 0;                                                       // TEXT cursor flashes at 2Hz of emulated time
+	unsigned long long int halfSecond = 0;                                        // of emulated time, the caches are redrawn after each
+	int videoMode = -1;                                                           // the display switches, the caches are redrawn when they change
 
-	SDL_Rect drvRect[2] = { { 272, 188, 4, 4 }, { 276, 188, 4, 4 } };             // disk drive status squares
+	SDL_Rect drvRect[DRIVES] = { { 272, 188, 4, 4 }, { 276, 188, 4, 4 },          // disk drive status squares
+	                             { 262, 188, 4, 4 }, { 266, 188, 4, 4 } };        // slot 5 ones on their left
 	SDL_Rect pixelGR = { 0, 0, 7, 4 };                                            // a block in LoRes
 	SDL_Rect dstRect = { 0, 0, 7, 8 };                                            // the dst character in rdr
 	SDL_Rect charRects[128];                                                      // the src from the norm and rev textures
@@ -410,54 +165,6 @@ int main(int argc, char *argv[]) {
 		charRects[c].h = 8;
 	}
 
-	const int color[16][3] = {                                                    // the 16 low res colors
-		{ 0,   0,   0	  }, { 226, 57,  86  }, { 28,  116, 205 }, { 126, 110, 173 },
-		{ 31,  129, 128 }, { 137, 130, 122 }, { 86,  168, 228 }, { 144, 178, 223 },
-		{ 151, 88,  34	}, { 234, 108, 21  }, { 158, 151, 143 }, { 255, 206, 240 },
-		{ 144, 192, 49	}, { 255, 253, 166 }, { 159, 210, 213 }, { 255, 255, 255 }
-	};
-
-	const int hcolor[16][3] = {                                                   // the high res colors (2 light levels)
-		{ 0,   0,   0   }, { 144, 192, 49  }, { 126, 110, 173 }, { 255, 255, 255 },
-		{ 0,   0,   0   }, { 234, 108, 21  }, { 86,  168, 228 }, { 255, 255, 255 },
-		{ 0,   0,   0   }, { 63,  55,	 86  }, { 72,  96,  25	}, { 255, 255, 255 },
-		{ 0,   0,   0   }, { 43,  84,	 114 }, { 117, 54,  10	}, { 255, 255, 255 }
-	};
-
-	const int offsetGR[24] = {                                                    // helper for TEXT and GR video generation
-		0x0000, 0x0080, 0x0100, 0x0180, 0x0200, 0x0280, 0x0300, 0x0380,             // lines 0-7
-		0x0028, 0x00A8, 0x0128, 0x01A8, 0x0228, 0x02A8, 0x0328, 0x03A8,             // lines 8-15
-		0x0050, 0x00D0, 0x0150, 0x01D0, 0x0250, 0x02D0, 0x0350, 0x03D0              // lines 16-23
-	};
-
-	const int offsetHGR[192] = {                                                  // helper for HGR video generation
-		0x0000, 0x0400, 0x0800, 0x0C00, 0x1000, 0x1400, 0x1800, 0x1C00,             // lines 0-7
-		0x0080, 0x0480, 0x0880, 0x0C80, 0x1080, 0x1480, 0x1880, 0x1C80,             // lines 8-15
-		0x0100, 0x0500, 0x0900, 0x0D00, 0x1100, 0x1500, 0x1900, 0x1D00,             // lines 16-23
-		0x0180, 0x0580, 0x0980, 0x0D80, 0x1180, 0x1580, 0x1980, 0x1D80,
-		0x0200, 0x0600, 0x0A00, 0x0E00, 0x1200, 0x1600, 0x1A00, 0x1E00,
-		0x0280, 0x0680, 0x0A80, 0x0E80, 0x1280, 0x1680, 0x1A80, 0x1E80,
-		0x0300, 0x0700, 0x0B00, 0x0F00, 0x1300, 0x1700, 0x1B00, 0x1F00,
-		0x0380, 0x0780, 0x0B80, 0x0F80, 0x1380, 0x1780, 0x1B80, 0x1F80,
-		0x0028, 0x0428, 0x0828, 0x0C28, 0x1028, 0x1428, 0x1828, 0x1C28,
-		0x00A8, 0x04A8, 0x08A8, 0x0CA8, 0x10A8, 0x14A8, 0x18A8, 0x1CA8,
-		0x0128, 0x0528, 0x0928, 0x0D28, 0x1128, 0x1528, 0x1928, 0x1D28,
-		0x01A8, 0x05A8, 0x09A8, 0x0DA8, 0x11A8, 0x15A8, 0x19A8, 0x1DA8,
-		0x0228, 0x0628, 0x0A28, 0x0E28, 0x1228, 0x1628, 0x1A28, 0x1E28,
-		0x02A8, 0x06A8, 0x0AA8, 0x0EA8, 0x12A8, 0x16A8, 0x1AA8, 0x1EA8,
-		0x0328, 0x0728, 0x0B28, 0x0F28, 0x1328, 0x1728, 0x1B28, 0x1F28,
-		0x03A8, 0x07A8, 0x0BA8, 0x0FA8, 0x13A8, 0x17A8, 0x1BA8, 0x1FA8,
-		0x0050, 0x0450, 0x0850, 0x0C50, 0x1050, 0x1450, 0x1850, 0x1C50,
-		0x00D0, 0x04D0, 0x08D0, 0x0CD0, 0x10D0, 0x14D0, 0x18D0, 0x1CD0,
-		0x0150, 0x0550, 0x0950, 0x0D50, 0x1150, 0x1550, 0x1950, 0x1D50,
-		0x01D0, 0x05D0, 0x09D0, 0x0DD0, 0x11D0, 0x15D0, 0x19D0, 0x1DD0,
-		0x0250, 0x0650, 0x0A50, 0x0E50, 0x1250, 0x1650, 0x1A50, 0x1E50,
-		0x02D0, 0x06D0, 0x0AD0, 0x0ED0, 0x12D0, 0x16D0, 0x1AD0, 0x1ED0,             // lines 168-183
-		0x0350, 0x0750, 0x0B50, 0x0F50, 0x1350, 0x1750, 0x1B50, 0x1F50,             // lines 176-183
-		0x03D0, 0x07D0, 0x0BD0, 0x0FD0, 0x13D0, 0x17D0, 0x1BD0, 0x1FD0              // lines 184-191
-	};
-
-
 	//================================= LOAD NORMAL AND REVERSE CHARACTERS BITMAPS
 
 	char workDir[1000];                                                           // find the working directory
@@ -505,32 +212,133 @@ int main(int argc, char *argv[]) {
 	}
 	fclose(f);
 
+	workDir[workDirSize] = 0;
+	f = fopen(strncat(workDir, "rom/appleIIe.rom", 17), "rb");                    // the //e ROM, if any
+	if (f) {
+		if (fread(romIIe, 1, IIEROMSIZE, f) != IIEROMSIZE) memset(romIIe, 0, IIEROMSIZE);
+		fclose(f);
+	}
+
+	workDir[workDirSize] = 0;
+	f = fopen(strncat(workDir, "rom/videx.rom", 14), "rb");                       // the Videx firmware and glyphs, if any
+	if (f) {
+		if (fread(videxRom, 1, VIDEXROMSIZE, f) != VIDEXROMSIZE) memset(videxRom, 0, VIDEXROMSIZE);
+		fclose(f);
+	}
+	workDir[workDirSize] = 0;
+	f = fopen(strncat(workDir, "rom/videxFont.rom", 18), "rb");
+	if (f) {
+		if (fread(videxFont, 1, VIDEXFONTSIZE, f) != VIDEXFONTSIZE) memset(videxFont, 0, VIDEXFONTSIZE);
+		fclose(f);
+	}
+
+	workDir[workDirSize] = 0;
+	f = fopen(strncat(workDir, "rom/ssc.rom", 12), "rb");                         // the Super Serial Card firmware, if any
+	if (f) {
+		if (fread(sscRom, 1, SSCROMSIZE, f) != SSCROMSIZE) memset(sscRom, 0, SSCROMSIZE);
+		fclose(f);
+	}
+
 
 	//========================================================== VM INITIALIZATION
 
-	if (argc > 1) insertFloppy(wdo, argv[1], 0);                                  // load floppy if provided at command line
+	resetMachine();                                                               // power on
+
+	long rewindBudget = REWINDBUDGET;
+	int rewindFrames = REWINDFRAMES;
+	for (int i = 1, drv = 0; i < argc; i++) {                                     // load floppies provided at command line
+		if (!strcmp(argv[i], "--rewind") && i + 1 < argc)                           // options
+			rewindBudget = atol(argv[++i]);                                           // MB, 0 to disable
+		else if (!strcmp(argv[i], "--rewind-frames") && i + 1 < argc)
+			rewindFrames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--warp") && i + 1 < argc) {
+			warpSpeed = atoi(argv[++i]);                                              // frames per host frame, 0 : unthrottled
+			if (warpSpeed < 0 || warpSpeed > WARPMAX) warpSpeed = 0;
+			if (warpSpeed != 1) warpChoice = warpSpeed;
+		}
+		else if (!strcmp(argv[i], "--run-ahead") && i + 1 < argc) {
+			runAhead.frames = atoi(argv[++i]);                                        // frames, 0 to disable
+			if (runAhead.frames < 0) runAhead.frames = 0;
+			if (runAhead.frames > RUNAHEADMAX) runAhead.frames = RUNAHEADMAX;
+		}
+		else if (!strcmp(argv[i], "--iie")) {
+			if (!setApple2e(true))                                                    // instead of the II+
+				printf("the //e needs rom/appleIIe.rom (16 KB, $C000-$FFFF)\n");
+		}
+		else if (!strcmp(argv[i], "--videx")) {
+			if (!setVidex(true))                                                      // in slot 3
+				printf("the Videx needs rom/videx.rom (1 KB) and rom/videxFont.rom (2 KB)\n");
+		}
+		else if (!strcmp(argv[i], "--serial") && i + 1 < argc) {
+			if (openSerial(argv[++i]))                                                // pty, or a Unix socket
+				printf("serial card on %s\n", serialName());
+			else
+				printf("%s could not be opened for the serial card\n", argv[i]);
+		}
+		else if (!strcmp(argv[i], "--saturn") && i + 1 < argc) {
+			if (!setLanguageCard(atoi(argv[++i])))                                    // KB, instead of the language card
+				printf("a Saturn card holds 16, 32, 64 or 128 KB\n");
+		}
+		else if (!strcmp(argv[i], "--run") && i + 1 < argc)
+			runAddress = strtol(argv[i + 1] + (argv[i + 1][0] == '$'), NULL, 16) & 0xFFFF, i++;  // instead of booting
+		else if (!strcmp(argv[i], "--load") && i + 1 < argc)
+			i++;                                                                      // loaded once the cpu is reset
+		else if (hasExtension(argv[i], ".state") || hasExtension(argv[i], ".movie"))
+			continue;                                                                 // loaded once the cpu is reset
+		else if (hasExtension(argv[i], ".wav"))
+			insertTape(argv[i]);                                                      // or a tape
+		else if (!insertHardDisk(argv[i]) && drv < DRIVES)                          // or a hard disk
+			insertFloppy(argv[i], drv++);                                             // S6D1, S6D2, S5D1 then S5D2
+	}
 
 	// reset the CPU
-	puce6502RST();                                                                // reset the 6502
+	pressReset();                                                                 // reset the 6502
 
 	// dirty hack, fix soon... if I understand why
 	ram[0x4D] = 0xAA;   // Joust crashes if this memory location equals zero
 	ram[0xD0] = 0xAA;   // Planetoids won't work if this memory location equals zero
 
+	for (int i = 1; i < argc; i++)                                                // or resume a saved session
+		if (hasExtension(argv[i], ".state") && !loadStateFile(argv[i]))
+			printf("%s is not a valid state file\n", argv[i]);
+		else if (hasExtension(argv[i], ".movie") && !moviePlay(argv[i]))
+			printf("%s is not a valid movie file\n", argv[i]);
+		else if (!strcmp(argv[i], "--load") && i + 1 < argc && loadSegment(argv[++i]) < 0)
+			printf("%s could not be loaded\n", argv[i]);                              // binaries, in the order given
+	if (!historyInit(rewindBudget, rewindFrames))
+		printf("not enough memory for the rewind buffer\n");
+	updateTitle();
+
 
 	//================================================================== MAIN LOOP
 
 	while (running) {
-
-		if (!paused) {                                                              // the apple II is clocked at 1023000.0 Hhz
-			puce6502Exec(17050);                                                      // execute instructions for 1/60 of a second
-			while (disk[curDrv].motorOn && ++tries)                                   // until motor is off or i reaches 255+1=0
-				puce6502Exec(5000);                                                     // speed up drive access artificially
+		int frames = 0;                                                             // emulated this host frame
+
+		if (rewinding && !paused) {
+			movieStop();                                                              // a movie can't follow
+			historyStep();                                                            // one snapshot back each frame
+		} else if (!paused) {                                                       // the apple II is clocked at 1023000.0 Hhz
+			Uint32 frameStart = SDL_GetTicks();
+			warp = warpSpeed != 1;                                                    // the sound is muted in warp
+			movieExec(FRAMECYCLES);                                                   // execute instructions for 1/60 of a second
+			frames++;
+			warp = true;                                                              // speed up drive access artificially :
+			while ((frames < warpSpeed || !warpSpeed || disksSpinning() || keysPending()) // nor while pasting,
+			       && SDL_GetTicks() - frameStart < WARPTIME) {                       // N frames in warp, or as many as fit
+				movieExec(FRAMECYCLES);                                                 // only the last one is rendered
+				frames++;
+			}
+			warp = false;
+			if (movie.mode != PLAYING)                                                // a replay doesn't write the floppies
+				flushFloppies();                                                        // outside of any disk access
+			historyCapture();                                                         // every few frames
 		}
 
 
 		//=============================================================== USER INPUT
 
+		movieMark();                                                                // to find out what the host changed
 		while (SDL_PollEvent(&event)) {
 			alt   = SDL_GetModState() & KMOD_ALT   ? true : false;
 			ctrl  = SDL_GetModState() & KMOD_CTRL  ? true : false;
@@ -550,15 +358,46 @@ int main(int argc, char *argv[]) {
 
 			if (event.type == SDL_DROPFILE) {                                         // user dropped a file
 				char *filename = event.drop.file;                                       // get full pathname
-				if (!insertFloppy(wdo, filename, alt))                                  // if ALT is pressed : drv 1 else drv 0
-					SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load", "Not a valid nib file", NULL);
+				if (hasExtension(filename, ".movie")) {                                 // a movie starts from its own state
+					if (!moviePlay(filename))
+						SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Play", "Not a valid movie file", NULL);
+					SDL_free(filename);
+					paused = false;
+					continue;
+				}
+				if (hasExtension(filename, ".state")) {                                 // a save state replaces everything
+					movieStop();
+					saveHardDisk();                                                       // its changes would be dropped with another one
+					if (!loadStateFile(filename))
+						SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load state", "Not a valid state file", NULL);
+					SDL_free(filename);
+					paused = false;
+					continue;
+				}
+				if (hasExtension(filename, ".wav")) {                                   // a tape goes into the tape deck
+					if (!insertTape(filename))
+						SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load", "Not a valid wav file", NULL);
+					else
+						movieInsert('T', 0, filename);
+					SDL_free(filename);
+					continue;                                                             // no reboot, type LOAD
+				}
+				int drv = (shift ? 2 : 0) + (alt ? 1 : 0);                              // ALT : drive 2, SHIFT : slot 5
+				if (insertHardDisk(filename))
+					movieInsert('D', 0, filename);
+				else if (insertFloppy(filename, drv))
+					movieInsert('I', drv, filename);
+				else
+					SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load", "Not a valid disk image", NULL);
 				SDL_free(filename);                                                     // free filename memory
 				paused = false;                                                         // might already be the case
 
-				if (!(alt || ctrl)) {                                                   // if ALT or CTRL were not pressed
+				if (!(alt || ctrl || shift)) {                                          // if ALT, CTRL or SHIFT were not pressed
+					movieEvent('C', NULL, 0);                                             // (before the reset takes its cycles)
 					ram[0x3F4] = 0;                                                       // unset the Power-UP byte
-					puce6502RST();                                                        // do a cold reset
+					pressReset();                                                         // do a cold reset
 					memset(ram, 0, sizeof(ram));
+					memset(aux, 0, sizeof(aux));
 				}
 			}
 
@@ -568,23 +407,35 @@ int main(int argc, char *argv[]) {
 				// EMULATOR CONTROLS :
 
 				case SDLK_F1:                                                           // SAVES
-					if (ctrl) {
-						if (saveFloppy(0))
-							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Save", "\nDisk 1 saved back to file\n", NULL);
-						else
-							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Save", "\nTError while saving Disk 1\n", NULL);
-					} else if (alt) {
-						if (saveFloppy(1))
-							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Save", "\nDisk 2 saved back to file\n", NULL);
-						else
-							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Save", "\nError while saving Disk 2\n", NULL);
+					if (ctrl || alt) {
+						int drv = (shift ? 2 : 0) + (alt ? 1 : 0);                          // SHIFT : slot 5
+						char msg[64];
+						sprintf(msg, "\n%s %d %s\n", drv < 2 ? "Disk" : "Slot 5 disk", drv % 2 + 1, saveFloppy(drv) ? "saved back to file" : "could not be saved");
+						SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Save", msg, NULL);
 					} else {
-						SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_WARNING, "Save", "CTRL-F1 to save D1\nALT-F1 to save D2\n", NULL);
+						SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_WARNING, "Save", "Changes are saved when the drive motor stops\nCTRL-F1 to save D1 now\nALT-F1 to save D2 now\nadd SHIFT for the slot 5 drives\n", NULL);
 					}
 				break;
 
 
 				case SDLK_F2: {                                                         // SCREENSHOTS
+					if (shift || ctrl || alt) {                                           // or SAVE STATES and MOVIES
+						char name[420];                                                     // next to the floppy in drive 1
+						sprintf(name, "%s.%s", disk[0].filename[0] ? disk[0].filename : "reinette", alt ? "movie" : "state");
+						if (alt && movie.mode == RECORDING)
+							movieStop();
+						else if (alt && !movieRecord(name))
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Record", "Could not write the movie file", NULL);
+						if (shift && !alt && !saveStateFile(name))
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Save state", "Could not write the state file", NULL);
+						if (ctrl && !alt) {
+							movieStop();
+							saveHardDisk();                                                   // its changes would be dropped with another one
+						}
+						if (ctrl && !alt && !loadStateFile(name))
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load state", "No valid state file for this floppy", NULL);
+						break;
+					}
 					sshot = SDL_GetWindowSurface(wdo);
 					SDL_RenderReadPixels(rdr, NULL, SDL_GetWindowPixelFormat(wdo), sshot->pixels, sshot->pitch);
 					workDir[workDirSize] = 0;
@@ -605,14 +456,28 @@ int main(int argc, char *argv[]) {
 				break;
 
 				case SDLK_F3:                                                           // PASTE text from clipboard
-					if (SDL_HasClipboardText()) {
+					if (ctrl) {                                                           // or copy the Applesoft program
+						char *listing = listBasic();
+						if (!listing || SDL_SetClipboardText(listing))
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Copy", "No Applesoft program in memory", NULL);
+						free(listing);
+						break;
+					}
+					if (alt && SDL_HasClipboardText() && movie.mode != PLAYING) {         // or put it there
 						char *clipboardText = SDL_GetClipboardText();
-						int c = 0;
-						while (clipboardText[c]) {                                          // all chars until ascii NUL
-							KBD = clipboardText[c++] | 0x80;                                  // set bit7
-							if (KBD == 0x8A) KBD = 0x8D;                                      // translate Line Feed to Carriage Ret
-							puce6502Exec(400000);                                             // give cpu (and applesoft) some cycles to process each char
-						}
+						if (!basicPrompt())
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load", "Applesoft is not waiting for a command", NULL);
+						else if (!loadBasic(clipboardText, strlen(clipboardText)))
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Load", "Not an Applesoft listing, or too large", NULL);
+						else if (shift)
+							typeText("RUN\n", 4);                                             // and start it
+						SDL_free(clipboardText);
+						break;
+					}
+					if (!alt && SDL_HasClipboardText() && movie.mode != PLAYING) {
+						char *clipboardText = SDL_GetClipboardText();
+						if (!typeText(clipboardText, strlen(clipboardText)))                // typed as fast as it is read
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Paste", "Not enough memory", NULL);
 						SDL_free(clipboardText);                                            // release the ressource
 					}
 				break;
@@ -640,6 +505,10 @@ int main(int argc, char *argv[]) {
 				break;
 
 				case SDLK_F7:                                                           // ZOOM
+					if (alt) {                                                            // or RUN-AHEAD
+						runAhead.frames = (runAhead.frames + 1) % (RUNAHEADMAX + 1);        // 0 (off), 1, 2 ... frames
+						break;
+					}
 					if (shift && (zoom < 8)) zoom++;                                      // zoom in
 					if (ctrl && (zoom > 1)) zoom--;                                       // zoom out
 					if (!ctrl && !shift) zoom = 2;                                        // reset zoom to 2
@@ -647,9 +516,34 @@ int main(int argc, char *argv[]) {
 					SDL_RenderSetScale(rdr, zoom, zoom);                                  // update renderer size
 				break;
 
-				case SDLK_F10: paused = !paused; break;                                  // toggle pause
+				case SDLK_F8:                                                           // CASSETTE
+					if (shift) {                                                          // start / stop recording
+						workDir[workDirSize] = 0;
+						if (!recordTape(strncat(workDir, "cassette.wav", 13)))
+							SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_ERROR, "Tape", "\nError while recording cassette.wav\n", NULL);
+					}
+					if (ctrl) tape.fastLoad = !tape.fastLoad;                             // toggle fast load
+					if (!ctrl && !shift) rewindTape();                                    // rewind the tape
+				break;
 
-				case SDLK_F11: puce6502RST(); break;                                    // simulate a reset
+				case SDLK_F9:                                                           // WARP
+					if (alt) {                                                            // or DISK HLE
+						hleDisk = !hleDisk;                                                 // toggle the fast DOS 3.3 accesses
+						break;
+					}
+					if (shift && warpChoice) warpChoice = warpChoice < WARPMAX ? warpChoice * 2 : 0;
+					if (ctrl) warpChoice = warpChoice ? (warpChoice > 2 ? warpChoice / 2 : 2) : WARPMAX;
+					if (!ctrl && !shift) warpSpeed = warpSpeed == 1 ? warpChoice : 1;     // toggle warp
+					else if (warpSpeed != 1) warpSpeed = warpChoice;                      // faster or slower now
+					updateTitle();
+				break;
+
+				case SDLK_F10:
+					if (shift) rewinding = true;                                          // until the key is released
+					else paused = !paused;                                                // toggle pause
+				break;
+
+				case SDLK_F11: movieEvent('R', NULL, 0); pressReset(); break;           // simulate a reset
 
 				case SDLK_F12:                                                          // help box
 					SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_INFORMATION, "Help",
@@ -657,9 +551,16 @@ int main(int argc, char *argv[]) {
 							"\n"
               "ctrl F1\twrites the changes of the floppy in drive 0\n"
               "alt F1\twrites the changes of the floppy in drive 1\n"
+              "\t(add shift for the slot 5 drives)\n"
               "\n"
 							"F2\tsave a screenshot into the screenshots directory\n"
+              "shift F2\tsave the machine state next to the floppy\n"
+              "ctrl F2\trestore the machine state\n"
+              "alt F2\tstart / stop recording a movie\n"
               "F3\tpaste text from clipboard\n"
+              "ctrl F3\tcopy the Applesoft program to clipboard\n"
+              "alt F3\tload the Applesoft program from clipboard\n"
+              "\t(add shift to RUN it)\n"
               "\n"
 							"F4\tmute / un-mute sound\n"
               "shift F4\tincrease volume\n"
@@ -676,8 +577,19 @@ int main(int argc, char *argv[]) {
 							"F7\treset zoom to 2:1\n"
               "shift F7\tincrease zoom up to 8:1\n"
               "ctrl F7\tdecrease zoom down to 1:1\n"
+              "alt F7\trun ahead 0 to 4 frames\n"
+							"\n"
+							"F8\trewind the tape\n"
+              "shift F8\tstart / stop recording cassette.wav\n"
+              "ctrl F8\ttoggle tape fast load\n"
+							"\n"
+              "F9\ttoggle warp speed (x8 by default)\n"
+              "shift F9\tdouble the warp speed, then unthrottled\n"
+              "ctrl F9\thalve the warp speed\n"
+              "alt F9\ttoggle fast DOS 3.3 disk accesses\n"
 							"\n"
               "F10\tpause / un-pause the emulator\n"
+              "shift F10\thold to rewind\n"
 							"F11\treset\n"
               "\n"
 							"F12\tthis help\n"
@@ -752,6 +664,7 @@ int main(int argc, char *argv[]) {
 
 			if (event.type == SDL_KEYUP) {
 				switch (event.key.keysym.sym) {
+				case SDLK_F10:          rewinding = false;         break;               // stop going back
 				case SDLK_KP_1:         GCD[0] = 1;  GCA[0] = 0;   break;               // pdl0 ->
 				case SDLK_KP_3:         GCD[0] = -1; GCA[0] = 0;   break;               // pdl0 <-
 				case SDLK_KP_5:         GCD[1] = 1;  GCA[1] = 0;   break;               // pdl1 ->
@@ -760,26 +673,78 @@ int main(int argc, char *argv[]) {
 			}
 		}
 
-		for (int pdl = 0; pdl < 2; pdl++) {                                         // update the two paddles positions
-			if (GCA[pdl]) {                                                           // actively pushing the stick
-				GCP[pdl] += GCD[pdl] * GCActionSpeed;
-				if (GCP[pdl] > 255) GCP[pdl] = 255;
-				if (GCP[pdl] < 0)   GCP[pdl] = 0;
-			} else {                                                                  // the stick is return back to center
-				GCP[pdl] += GCD[pdl] * GCReleaseSpeed;
-				if (GCD[pdl] == 1  && GCP[pdl] > 127) GCP[pdl] = 127;
-				if (GCD[pdl] == -1 && GCP[pdl] < 127) GCP[pdl] = 127;
-			}
-		}
+		movePaddles(frames);                                                        // as far as the machine went
+		movieInputs();                                                              // log them, or override them in a replay
+
+
+		if (!paused && !rewinding && warpSpeed == 1) runAheadStart();               // show a frame from the future
 
 
 		//============================================================= VIDEO OUTPUT
 
+		flashCycle = ticks / FRAMECYCLES % 30;                                      // follows the emulated frames
+		bool redraw = ticks / FRAMECYCLES / 30 != halfSecond;                       // a new half second, or rewound
+		halfSecond = ticks / FRAMECYCLES / 30;
+		bool videoterm = videxShown();
+		int mode = TEXT | MIXED << 1 | HIRES << 2 | PAGE2 << 3 | STORE80 << 4 | COL80 << 5 | DHIRES << 6 | ALTCHAR << 7;
+		mode |= videoterm << 8;
+		if (mode != videoMode) redraw = true;                                       // another page, or another mode
+		videoMode = mode;
+
+		bool page2 = PAGE2 && !STORE80;                                             // with 80STORE, PAGE2 selects the //e memory
+		int columns = apple2e && COL80 ? 80 : 40;
+
+		// VIDEX 80 COLUMNS
+		if (videoterm) {
+			unsigned long rows = videxRows();                                         // only the rows written to
+			if (redraw) rows = VIDEXALLROWS;
+			SDL_Rect band = { 0, 0, VIDEXCOLUMNS * 8, VIDEXLINES };                   // a row of glyphs
+
+			SDL_RenderSetScale(rdr, zoom * 280.0f / (VIDEXCOLUMNS * 8), zoom * 192.0f / (VIDEXROWS * VIDEXLINES));
+			for (int row = 0; row < VIDEXROWS; row++) {
+				if (!(rows & 1ul << row)) continue;
+				band.y = row * VIDEXLINES;
+				SDL_SetRenderDrawColor(rdr, 0, 0, 0, SDL_ALPHA_OPAQUE);
+				SDL_RenderFillRect(rdr, &band);
+				SDL_SetRenderDrawColor(rdr, 255, 255, 255, SDL_ALPHA_OPAQUE);           // white on black
+				for (int line = 0; line < VIDEXLINES; line++)
+					for (int col = 0; col < VIDEXCOLUMNS; col++) {
+						uint8_t dots = videxDots(row, line, col);
+						for (int x = 0; dots; x++, dots <<= 1)
+							if (dots & 0x80) SDL_RenderDrawPoint(rdr, col * 8 + x, band.y + line);
+					}
+			}
+			SDL_RenderSetScale(rdr, zoom, zoom);
+		}
+
+		// DOUBLE HIGH RES GRAPHICS
+		else if (apple2e && COL80 && DHIRES && HIRES && !TEXT) {
+			uint16_t vRamBase = 0x2000 + page2 * 0x2000;
+			uint8_t lastLine = MIXED ? 160 : 192;
+			uint8_t bits[560];
+
+			SDL_RenderSetScale(rdr, zoom / 2.0f, zoom);                               // 560 dots per line
+			for (int line = 0; line < lastLine; line++) {                             // redrawn every frame, no cache
+				for (int col = 0; col < 80; col++) {                                    // aux holds the even bytes
+					uint16_t address = vRamBase + offsetHGR[line] + col / 2;
+					uint8_t byte = col & 1 ? ram[address] : aux[address];
+					for (int bit = 0; bit < 7; bit++) bits[col * 7 + bit] = (byte >> bit) & 1;
+				}
+				for (int x = 0; x < 560; x += 4) {                                      // 4 dots give a low res color
+					uint8_t colorIdx = bits[x] | bits[x + 1] << 1 | bits[x + 2] << 2 | bits[x + 3] << 3;
+					SDL_Rect dots = { x, line, 4, 1 };
+					SDL_SetRenderDrawColor(rdr, color[colorIdx][0], color[colorIdx][1], color[colorIdx][2], SDL_ALPHA_OPAQUE);
+					SDL_RenderFillRect(rdr, &dots);
+				}
+			}
+			SDL_RenderSetScale(rdr, zoom, zoom);
+		}
+
 		// HIGH RES GRAPHICS
-		if (!TEXT && HIRES) {
+		else if (!TEXT && HIRES) {
 			uint16_t word;
 			uint8_t bits[16], bit, pbit, colorSet, even;
-			uint16_t vRamBase = 0x2000 + PAGE2 * 0x2000;
+			uint16_t vRamBase = 0x2000 + page2 * 0x2000;
 			uint8_t lastLine = MIXED ? 160 : 192;
 			uint8_t colorIdx = 0;                                                     // to index the color arrays
 
@@ -791,7 +756,7 @@ int main(int argc, char *argv[]) {
 					word = (uint16_t)(ram[vRamBase + offsetHGR[line] + col + 1]) << 8;    // store the two next bytes into 'word'
 					word +=           ram[vRamBase + offsetHGR[line] + col];              // in reverse order
 
-					if (HiResCache[line][col] != word || !flashCycle) {                   // check if this group of 7 dots need a redraw
+					if (HiResCache[line][col] != word || redraw) {                        // check if this group of 7 dots need a redraw
 
 						for (bit=0; bit < 16; bit++)                                        // store all bits 'word' into 'bits'
 							bits[bit] = (word >> bit) & 1;
@@ -823,7 +788,7 @@ int main(int argc, char *argv[]) {
 
 		// lOW RES GRAPHICS
 		else if (!TEXT) {                                                           // and not in HIRES
-			uint16_t vRamBase = 0x400 + PAGE2 * 0x0400;
+			uint16_t vRamBase = 0x400 + page2 * 0x0400;
 			uint8_t lastLine = MIXED ? 20 : 24;
 			uint8_t glyph;                                                            // 2 blocks in GR
 			uint8_t colorIdx = 0;                                                     // to index the color arrays
@@ -834,7 +799,7 @@ int main(int argc, char *argv[]) {
 					pixelGR.y = line * 8;                                                 // first block
 
 					glyph = ram[vRamBase + offsetGR[line] + col];                         // read video memory
-					if (LoResCache[line][col] != glyph || !flashCycle) {
+					if (LoResCache[line][col] != glyph || redraw) {
 						LoResCache[line][col] = glyph;
 
 						colorIdx = glyph & 0x0F;                                              // first nibble
@@ -851,59 +816,78 @@ int main(int argc, char *argv[]) {
 		}
 
 		// TEXT 40 COLUMNS
-		if (TEXT || MIXED) {                                                        // not Full Graphics
-			uint16_t vRamBase = 0x400 +PAGE2 * 0x0400;
+		if ((TEXT || MIXED) && columns == 40 && !videoterm) {                       // not Full Graphics
 			uint8_t firstLine = TEXT ? 0 : 20;
 			uint8_t glyph;                                                            // a TEXT character
+			bool reverse;                                                             // INVERSE, or FLASH half of the time
 
 			for (int col = 0; col < 40; col++) {                                      // for each column
 				dstRect.x = col * 7;
 				for (int line = firstLine; line < 24; line++) {                         // for each row
 					dstRect.y = line * 8;
 
-					glyph = ram[vRamBase + offsetGR[line] + col];                         // read video memory
-					if (glyph > 0x7F) glyphAttr = A_NORMAL;                               // is NORMAL ?
-					else if (glyph < 0x40) glyphAttr = A_INVERSE;                         // is INVERSE ?
-					else glyphAttr = A_FLASH;                                             // it's FLASH !
-
-					if (glyphAttr==A_FLASH || TextCache[line][col]!=glyph || !flashCycle){
+					glyph = textByte(line, col, 40);                                      // read video memory
+					if ((glyph & 0xC0) == 0x40 || TextCache[line][col] != glyph || redraw) { // FLASH is always redrawn
 						TextCache[line][col] = glyph;
+						glyph = textGlyph(glyph, flashCycle >= 15, &reverse);
+						SDL_RenderCopy(rdr, reverse ? revCharTexture : normCharTexture, &charRects[glyph], &dstRect);
+					}
+				}
+			}
+		}
 
-						glyph &= 0x7F;                                                        // unset bit 7
-						if (glyph > 0x5F) glyph &= 0x3F;                                      // shifts to match
-						if (glyph < 0x20) glyph |= 0x40;                                      // the ASCII codes
+		// TEXT 80 COLUMNS
+		else if ((TEXT || MIXED) && !videoterm) {                                   // the //e, redrawn every frame
+			bool reverse;
 
-						if (glyphAttr==A_NORMAL || (glyphAttr==A_FLASH && flashCycle<15))
-							SDL_RenderCopy(rdr, normCharTexture, &charRects[glyph], &dstRect);
-						else
-							SDL_RenderCopy(rdr, revCharTexture, &charRects[glyph], &dstRect);
-					}
+			SDL_RenderSetScale(rdr, zoom / 2.0f, zoom);                               // 560 dots per line
+			for (int col = 0; col < 80; col++) {
+				dstRect.x = col * 7;
+				for (int line = TEXT ? 0 : 20; line < 24; line++) {
+					dstRect.y = line * 8;
+					uint8_t glyph = textGlyph(textByte(line, col, 80), flashCycle >= 15, &reverse);
+					SDL_RenderCopy(rdr, reverse ? revCharTexture : normCharTexture, &charRects[glyph], &dstRect);
 				}
 			}
+			SDL_RenderSetScale(rdr, zoom, zoom);
 		}
 
 
 		//====================================================== DISPLAY DISK STATUS
 
-		if (disk[curDrv].motorOn) {                                                 // drive is active
-			if (disk[curDrv].writeMode)
-				SDL_SetRenderDrawColor(rdr, 255, 0, 0, 85);                             // red for writes
-			else
-				SDL_SetRenderDrawColor(rdr, 0, 255, 0, 85);                             // green for reads
-			SDL_RenderFillRect(rdr, &drvRect[curDrv]);                                // square actually
+		for (int ctl = 0; ctl < CONTROLLERS; ctl++) {
+			int drv = diskII[ctl].curDrv;
+			if (disk[drv].motorOn) {                                                  // drive is active
+				if (disk[drv].writeMode)
+					SDL_SetRenderDrawColor(rdr, 255, 0, 0, 85);                           // red for writes
+				else
+					SDL_SetRenderDrawColor(rdr, 0, 255, 0, 85);                           // green for reads
+				SDL_RenderFillRect(rdr, &drvRect[drv]);                                 // square actually
+			}
 		}
 
 
 		//========================================================= SDL RENDER FRAME
 
-		if (++flashCycle == 30)                                                     // increase cursor flash cycle
-			flashCycle = 0;                                                           // reset to zero every half second
 		SDL_RenderPresent(rdr);                                                     // swap buffers
+		runAheadStop();                                                             // and back to the present
 	}                                                                             // while (running)
 
 
 	//================================================ RELEASE RESSOURSES AND EXIT
 
+	if (tape.out) recordTape(NULL);                                               // finalize the wav being recorded
+	movieStop();                                                                  // and the movie
+	if (hdd.image && !hdd.readOnly && !saveHardDisk())
+		SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_WARNING, "Save", "Changes to the hard disk could not be written", NULL);
+	ejectHardDisk();
+	closeSerial();
+	for (int drv = 0; drv < DRIVES; drv++)                                        // last chance to write the changes
+		if (disk[drv].filename[0] && !disk[drv].readOnly && !saveFloppy(drv)) {
+			char msg[64];
+			sprintf(msg, "Changes to %s %d could not be written", drv < 2 ? "Disk" : "Slot 5 disk", drv % 2 + 1);
+			SDL_ShowSimpleMessageBox(SDL_MESSAGEBOX_WARNING, "Save", msg, NULL);
+		}
 	SDL_AudioQuit();
 	SDL_Quit();
 	return 0;
@@ -0,0 +1,62 @@
+/*
+ * Reinette II plus, a french Apple II emulator
+ * the rewind ring : differences of uneven sizes pushed until it wraps twice,
+ * every one still listed must read back as it was written
+ * Copyright (c) 2020 Arthur Ferreira
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#include "../apple2.c"                                                          // for its static functions
+
+void queueSound(bool level, unsigned int length) {}
+void floppyInserted(int drv) {}
+void floppyNotSaved(int drv) {}
+
+
+static int check(int pushed) {                                                  // 0 if an entry was overwritten
+	for (int i = 0; i < history.count; i++) {
+		int e = (history.first + i) % REWINDMAX;
+		for (long b = 0; b < history.entries[e].length; b++)
+			if (history.ring[history.entries[e].offset + b] != (uint8_t)history.entries[e].ticks) {
+				printf("FAIL : delta %llu overwritten after %d pushes\n", history.entries[e].ticks, pushed);
+				return 0;
+			}
+	}
+	return 1;
+}
+
+
+int main() {
+	static const long sizes[] = { 60, 40, 25, 25, 55, 30, 35, 20, 45, 100, 10, 95 };
+	int count = sizeof(sizes) / sizeof(sizes[0]);
+	if (!historyInit(1, 0)) return 1;
+	history.budget = 100;                                                         // wraps twice along the way
+
+	for (int i = 0; i < count; i++) {
+		uint8_t delta[100];
+		memset(delta, i + 1, sizes[i]);                                             // the tick tells its content
+		historyPush(delta, sizes[i], 0, i + 1);
+		if (!check(i + 1)) return 1;
+	}
+	printf("rewind : %d deltas pushed, %d kept\n", count, history.count);
+	historyInit(0, 0);
+	return 0;
+}